@@ -7,6 +7,10 @@ static struct proc_dir_entry *proc_rx;
 static struct proc_dir_entry *proc_config;
 static struct proc_dir_entry *proc_status;
 static struct proc_dir_entry *proc_stats;
+static struct proc_dir_entry *proc_capture;
+static struct proc_dir_entry *proc_flight;
+static struct proc_dir_entry *proc_io;
+static struct proc_dir_entry *proc_latency;
 
 // Configuration and statistics
 static struct uart_config config = {
@@ -16,6 +20,7 @@ static struct uart_config config = {
 };
 
 static struct uart_stats stats = {0};
+static struct uart_cost cost = {0};
 
 // Mutex for thread-safe configuration changes
 static DEFINE_MUTEX(uart_config_mutex);
@@ -30,6 +35,254 @@ static void delay_cycles(int count)
     }
 }
 
+// Sleep and charge the time actually slept to *sleep_ns
+static void uart_cost_sleep(unsigned long min, unsigned long max, u64 *sleep_ns)
+{
+    u64 t0 = local_clock();
+    
+    usleep_range(min, max);
+    *sleep_ns += local_clock() - t0;
+}
+
+// ---------------------------------------------------------------------------
+// Trigger-armed capture
+//
+// While armed, every TX/RX byte is recorded with a timestamp into a circular
+// window. When the trigger fires (RX pattern, overrun or TX stall) the
+// window keeps recording for capture_post more records and then freezes
+// for readout through /proc/uart_capture.
+// ---------------------------------------------------------------------------
+
+#define UART_CAP_RECORDS      4096
+#define UART_CAP_PATTERN_MAX  16
+
+enum uart_cap_state {
+    UART_CAP_OFF,
+    UART_CAP_ARMED,
+    UART_CAP_TRIGGERED,
+    UART_CAP_FROZEN,
+};
+
+static struct uart_cap_record cap_buf[UART_CAP_RECORDS];
+static enum uart_cap_state cap_state;
+static u32 cap_head;         // records written since arming
+static u32 cap_post = UART_CAP_RECORDS / 2;
+static u32 cap_post_left;
+static u32 cap_trigger_mask = UART_CAP_TRIG_OVERRUN | UART_CAP_TRIG_TX_STALL;
+static u8 cap_pattern[UART_CAP_PATTERN_MAX];
+static u32 cap_pattern_len;
+static u8 cap_window[UART_CAP_PATTERN_MAX];  // last RX bytes, for matching
+static DEFINE_SPINLOCK(uart_cap_lock);
+
+// Append one record; caller holds uart_cap_lock
+static void uart_cap_append(u8 dir, u8 data, bool trigger)
+{
+    struct uart_cap_record *rec = &cap_buf[cap_head++ % UART_CAP_RECORDS];
+    
+    rec->ts_ns = local_clock();
+    rec->dir = dir;
+    rec->data = data;
+    rec->trigger = trigger;
+    
+    if (trigger && cap_state == UART_CAP_ARMED) {
+        cap_state = UART_CAP_TRIGGERED;
+        cap_post_left = cap_post;
+    } else if (cap_state == UART_CAP_TRIGGERED) {
+        cap_post_left--;
+    }
+    
+    // Freeze once exactly cap_post records follow the trigger
+    if (cap_state == UART_CAP_TRIGGERED && cap_post_left == 0) {
+        cap_state = UART_CAP_FROZEN;
+        pr_info("UART capture frozen\n");
+    }
+}
+
+// Does the RX stream now end with the trigger pattern?
+static bool uart_cap_match(u8 c)
+{
+    if (!cap_pattern_len || !(cap_trigger_mask & UART_CAP_TRIG_PATTERN)) {
+        return false;
+    }
+    
+    memmove(cap_window, cap_window + 1, UART_CAP_PATTERN_MAX - 1);
+    cap_window[UART_CAP_PATTERN_MAX - 1] = c;
+    
+    return memcmp(cap_window + UART_CAP_PATTERN_MAX - cap_pattern_len,
+                  cap_pattern, cap_pattern_len) == 0;
+}
+
+// Record one byte on the wire
+static void uart_cap_byte(u8 dir, u8 c)
+{
+    if (likely(READ_ONCE(cap_state) == UART_CAP_OFF ||
+               READ_ONCE(cap_state) == UART_CAP_FROZEN)) {
+        return;
+    }
+    
+    spin_lock(&uart_cap_lock);
+    if (cap_state == UART_CAP_ARMED || cap_state == UART_CAP_TRIGGERED) {
+        uart_cap_append(dir, c, dir == UART_CAP_RX && uart_cap_match(c));
+    }
+    spin_unlock(&uart_cap_lock);
+}
+
+// Record an error event; fires the trigger if it is enabled
+static void uart_cap_event(u8 event, u32 trigger)
+{
+    if (likely(READ_ONCE(cap_state) == UART_CAP_OFF ||
+               READ_ONCE(cap_state) == UART_CAP_FROZEN)) {
+        return;
+    }
+    
+    spin_lock(&uart_cap_lock);
+    if (cap_state == UART_CAP_ARMED || cap_state == UART_CAP_TRIGGERED) {
+        uart_cap_append(UART_CAP_EVENT, event, cap_trigger_mask & trigger);
+    }
+    spin_unlock(&uart_cap_lock);
+}
+
+static void uart_cap_arm(bool arm)
+{
+    spin_lock(&uart_cap_lock);
+    cap_head = 0;
+    memset(cap_window, 0, sizeof(cap_window));
+    cap_state = arm ? UART_CAP_ARMED : UART_CAP_OFF;
+    spin_unlock(&uart_cap_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Flight recorder
+//
+// With flight_addr/flight_size pointing at a reserved memory region (for
+// example memmap=64K$0x30000000 on the kernel command line), every TX/RX
+// burst is mirrored there as fixed-size records. Appends are lockless: a
+// slot is claimed with one atomic increment and its sequence number is
+// written last, so a record torn by a crash is recognisable. On load, the
+// records left by the previous boot are copied out and exposed through
+// /proc/uart_flight before recording restarts.
+// ---------------------------------------------------------------------------
+
+static unsigned long flight_addr;
+module_param(flight_addr, ulong, 0444);
+MODULE_PARM_DESC(flight_addr, "Physical address of the reserved flight recorder region");
+
+static unsigned long flight_size;
+module_param(flight_size, ulong, 0444);
+MODULE_PARM_DESC(flight_size, "Size of the flight recorder region in bytes");
+
+static void *flight_base;
+static struct uart_flight_hdr *flight_hdr;
+static struct uart_flight_record *flight_recs;
+static struct uart_flight_record *flight_prev;  // previous boot, oldest first
+static u32 flight_prev_count;
+
+// Mirror one burst; bursts longer than a record span several records
+static void uart_flight_log(u8 dir, const u8 *data, size_t len)
+{
+    struct uart_flight_record *rec;
+    size_t chunk;
+    u64 seq;
+    
+    if (!flight_hdr) {
+        return;
+    }
+    
+    while (len) {
+        chunk = min_t(size_t, len, UART_FLIGHT_DATA);
+        seq = atomic64_inc_return(&flight_hdr->head);
+        rec = &flight_recs[(seq - 1) & (flight_hdr->nrec - 1)];
+        
+        WRITE_ONCE(rec->seq, 0);
+        smp_wmb();
+        rec->ts_ns = local_clock();
+        rec->len = chunk;
+        rec->dir = dir;
+        memcpy(rec->data, data, chunk);
+        smp_wmb();
+        WRITE_ONCE(rec->seq, seq);
+        
+        data += chunk;
+        len -= chunk;
+    }
+}
+
+// Copy out whatever the previous boot left behind, oldest first
+static void uart_flight_recover(u32 nrec)
+{
+    struct uart_flight_record *rec;
+    u64 head = atomic64_read(&flight_hdr->head);
+    u64 seq;
+    
+    flight_prev = vmalloc(array_size(nrec, sizeof(*rec)));
+    if (!flight_prev) {
+        return;
+    }
+    
+    for (seq = head > nrec ? head - nrec + 1 : 1; seq <= head; seq++) {
+        rec = &flight_recs[(seq - 1) & (nrec - 1)];
+        if (rec->seq == seq && rec->len <= UART_FLIGHT_DATA) {
+            flight_prev[flight_prev_count++] = *rec;
+        }
+    }
+    
+    pr_info("Flight recorder: recovered %u records from previous boot\n",
+            flight_prev_count);
+}
+
+static void uart_flight_init(void)
+{
+    u32 nrec;
+    
+    if (!flight_addr || !flight_size) {
+        return;
+    }
+    
+    if (flight_size < sizeof(*flight_hdr) + 2 * sizeof(*flight_recs)) {
+        pr_warn("Flight recorder region too small, disabled\n");
+        return;
+    }
+    
+    flight_base = memremap(flight_addr, flight_size, MEMREMAP_WB);
+    if (!flight_base) {
+        pr_warn("Failed to map flight recorder region, disabled\n");
+        return;
+    }
+    
+    flight_hdr = flight_base;
+    flight_recs = flight_base + sizeof(*flight_hdr);
+    nrec = rounddown_pow_of_two((flight_size - sizeof(*flight_hdr)) /
+                                sizeof(*flight_recs));
+    
+    if (flight_hdr->magic == UART_FLIGHT_MAGIC && flight_hdr->nrec == nrec) {
+        uart_flight_recover(nrec);
+    }
+    
+    memset(flight_recs, 0, nrec * sizeof(*flight_recs));
+    atomic64_set(&flight_hdr->head, 0);
+    flight_hdr->nrec = nrec;
+    flight_hdr->magic = UART_FLIGHT_MAGIC;
+    
+    pr_info("Flight recorder: %u records at 0x%lx\n", nrec, flight_addr);
+}
+
+static void uart_flight_exit(void)
+{
+    if (flight_base) {
+        flight_hdr = NULL;
+        memunmap(flight_base);
+    }
+    vfree(flight_prev);
+}
+
+// Check a baud rate against the supported set
+static bool uart_baud_supported(u32 baud)
+{
+    return baud == BAUD_9600 || baud == BAUD_19200 ||
+           baud == BAUD_38400 || baud == BAUD_57600 ||
+           baud == BAUD_115200;
+}
+
 // Calculate baud rate register value
 static int calculate_baud_register(u32 baudrate, u16 *reg_value)
 {
@@ -181,24 +434,31 @@ static void uart_send_char(char c)
     // Wait until TX FIFO has space with timeout
     // CHANGED: usleep_range instead of udelay
     while (!(readl(&uart->MU_LSR) & (1 << 5)) && timeout-- > 0) {
-        usleep_range(1, 2);  // Sleep 1-2µs, much better than busy-wait
+        uart_cost_sleep(1, 2, &cost.tx_sleep_ns);  // Sleep 1-2µs, much better than busy-wait
     }
     
     if (timeout <= 0) {
         stats.tx_errors++;
+        uart_cap_event(UART_CAP_EV_TX_STALL, UART_CAP_TRIG_TX_STALL);
         pr_warn("TX timeout occurred\n");
         return;
     }
     
     // Write character to TX FIFO
     writel((u32)(c & 0xFF), &uart->MU_IO);
+    uart_cap_byte(UART_CAP_TX, c);
     stats.tx_bytes++;
 }
 
 // Send a string
 static void uart_send_string(const char *s)
 {
+    u64 t0, sent;
+    
     mutex_lock(&uart_tx_mutex);
+    t0 = local_clock();
+    sent = stats.tx_bytes;
+    uart_flight_log(UART_CAP_TX, (const u8 *)s, strlen(s));
     
     while (*s) {
         if (*s == '\n') {
@@ -207,9 +467,42 @@ static void uart_send_string(const char *s)
         uart_send_char(*s++);
     }
     
+    cost.tx_time_ns += local_clock() - t0;
+    cost.tx_bytes += stats.tx_bytes - sent;  // nobody else sends meanwhile
     mutex_unlock(&uart_tx_mutex);
 }
 
+// Send raw bytes without newline translation; caller holds uart_tx_mutex
+static void uart_send_raw_locked(const u8 *data, size_t len)
+{
+    u64 t0 = local_clock();
+    int timeout;
+    size_t i;
+    
+    uart_flight_log(UART_CAP_TX, data, len);
+    
+    for (i = 0; i < len; i++) {
+        timeout = 10000;
+        while (!(readl(&uart->MU_LSR) & (1 << 5)) && timeout-- > 0) {
+            uart_cost_sleep(1, 2, &cost.tx_sleep_ns);
+        }
+        
+        if (timeout <= 0) {
+            stats.tx_errors++;
+            uart_cap_event(UART_CAP_EV_TX_STALL, UART_CAP_TRIG_TX_STALL);
+            pr_warn("TX timeout occurred\n");
+            break;
+        }
+        
+        writel(data[i], &uart->MU_IO);
+        uart_cap_byte(UART_CAP_TX, data[i]);
+        stats.tx_bytes++;
+    }
+    
+    cost.tx_time_ns += local_clock() - t0;
+    cost.tx_bytes += i;
+}
+
 // Check if data is available to receive
 static int uart_data_available(void)
 {
@@ -223,6 +516,7 @@ static void uart_check_rx_errors(void)
     
     if (lsr & (1 << 1)) {  // Overrun error
         stats.fifo_overruns++;
+        uart_cap_event(UART_CAP_EV_OVERRUN, UART_CAP_TRIG_OVERRUN);
         pr_warn("UART RX FIFO overrun detected\n");
     }
 }
@@ -230,6 +524,8 @@ static void uart_check_rx_errors(void)
 // Receive a single character (non-blocking)
 static char uart_receive_char(void)
 {
+    char c;
+    
     if (!uart_data_available()) {
         return 0;
     }
@@ -237,319 +533,5614 @@ static char uart_receive_char(void)
     uart_check_rx_errors();
     stats.rx_bytes++;
     
-    return (char)(readl(&uart->MU_IO) & 0xFF);
+    c = (char)(readl(&uart->MU_IO) & 0xFF);
+    uart_cap_byte(UART_CAP_RX, c);
+    return c;
 }
 
-// Proc file read handler for receiving data
-// CHANGED: usleep_range instead of udelay - HUGE performance improvement!
-static ssize_t uart_proc_read(struct file *file, char __user *buf, 
-                              size_t count, loff_t *ppos)
+// ---------------------------------------------------------------------------
+// Service path
+//
+// A kthread that keeps the FIFOs serviced while an in-kernel client is open
+// or rx_mode=service is selected. Each pass drains the RX FIFO into a burst,
+// delivers it, tops up the TX FIFO from the client write queue and sleeps
+// for roughly half a FIFO worth of character times.
+// ---------------------------------------------------------------------------
+
+#define UART_RX_BUF_SIZE 65536  // power of two
+#define UART_RX_MARKS    1024   // power of two
+#define UART_RX_EVENTS   256    // power of two
+#define UART_RX_READ_MAX 4096
+#define UART_RX_BURST    64
+
+struct uart_tx_req {
+    struct list_head node;
+    struct rpi2_uart_client *client;
+    rpi2_uart_tx_done_cb done;
+    void *ctx;
+    size_t len;
+    size_t pos;
+    u8 data[];
+};
+
+static struct task_struct *uart_svc_thread;
+static int uart_svc_users;
+static int uart_rx_owners;    // polled readers and transfers on the RX FIFO
+static DEFINE_MUTEX(uart_svc_mutex);
+static bool uart_svc_kicked;  // work arrived since the current pass began
+
+// Hand the service thread new work, cutting its current sleep short
+static void uart_svc_kick(void)
 {
-    char kbuf[512];
-    int i = 0;
-    char c;
-    int consecutive_no_data = 0;
-    const int MAX_CONSECUTIVE_NO_DATA = 300;
+    WRITE_ONCE(uart_svc_kicked, true);
+    wake_up_process(uart_svc_thread);
+}
+
+static struct rpi2_uart_client *uart_client;
+static DEFINE_MUTEX(uart_client_mutex);
+// Held for reading across a client call's ownership check and its effect,
+// and for writing when ownership changes. Kept apart from
+// uart_client_mutex, which RX dispatch holds while the client's rx()
+// callback runs and may itself call rpi2_uart_write().
+static DECLARE_RWSEM(uart_client_sem);
+
+static LIST_HEAD(uart_txq);
+static DEFINE_SPINLOCK(uart_txq_lock);
+
+// Per-open-file I/O accounting for /proc/uart_io. Counters are only
+// updated by the owning file's own read/write/ioctl calls, so the hot path
+// is plain adds; the list lock only covers open, release and listing.
+// Each process also keeps totals that outlive its files, so short-lived
+// writers (echo > /proc/uart_tx) still show up. A file's counters are
+// folded into them at release. Beyond UART_IO_PROCS_MAX processes, the
+// least recently active one with no open files is forgotten.
+#define UART_IO_PROCS_MAX  64
+
+struct uart_io_proc {
+    struct list_head node;  // on uart_io_procs, least recent first
+    pid_t pid;
+    char comm[TASK_COMM_LEN];
+    u32 open_files;
+    u64 tx_bytes;
+    u64 rx_bytes;
+    u64 block_ns;
+    u64 queue_ns;
+    u64 drops;
+};
+
+struct uart_io_acct {
+    struct list_head node;
+    struct uart_io_proc *proc;
+    pid_t pid;              // thread group that opened the file
+    char comm[TASK_COMM_LEN];
+    char dir;               // 'R' for /proc/uart_rx, 'T' for /proc/uart_tx
+    u64 ops;
+    u64 bytes;              // read or written
+    u64 block_ns;           // waiting for data or for the transmitter
+    u64 queue_ns;           // TX: blocked beyond the data's own wire time
+    u64 drops;              // RX: bytes lost by falling a ring behind
+};
+
+static LIST_HEAD(uart_io_files);
+static LIST_HEAD(uart_io_procs);
+static u32 uart_io_nprocs;
+static DEFINE_SPINLOCK(uart_io_lock);
+
+// Add one file's counters to a process total
+static void uart_io_proc_fold(struct uart_io_proc *p,
+                              const struct uart_io_acct *acct)
+{
+    if (acct->dir == 'T') {
+        p->tx_bytes += acct->bytes;
+    } else {
+        p->rx_bytes += acct->bytes;
+    }
+    p->block_ns += acct->block_ns;
+    p->queue_ns += acct->queue_ns;
+    p->drops += acct->drops;
+}
+
+// Caller holds uart_io_lock
+static struct uart_io_proc *uart_io_proc_find(pid_t pid)
+{
+    struct uart_io_proc *p;
     
-    if (*ppos > 0) {
-        return 0;
+    list_for_each_entry(p, &uart_io_procs, node) {
+        if (p->pid == pid) {
+            return p;
+        }
     }
     
-    mutex_lock(&uart_rx_mutex);
+    return NULL;
+}
+
+static int uart_io_acct_add(struct uart_io_acct *acct, char dir)
+{
+    struct uart_io_proc *p, *fresh, *old = NULL;
     
-    // Wait for first character with timeout
-    // CHANGED: usleep_range instead of udelay(1000)
-    int timeout = 1000;  // 1 second total
-    while (!uart_data_available() && timeout-- > 0) {
-        usleep_range(1000, 1500);  // Sleep 1-1.5ms (was busy-waiting!)
-    }
+    acct->pid = task_tgid_nr(current);
+    get_task_comm(acct->comm, current);
+    acct->dir = dir;
     
-    if (timeout <= 0) {
-        mutex_unlock(&uart_rx_mutex);
-        return 0;
+    fresh = kzalloc(sizeof(*fresh), GFP_KERNEL);
+    if (!fresh) {
+        return -ENOMEM;
     }
     
-    // Read all available characters
-    while (i < (sizeof(kbuf) - 1) && i < count) {
-        while (uart_data_available() && i < (sizeof(kbuf) - 1) && i < count) {
-            c = uart_receive_char();
-            if (c != 0) {
-                kbuf[i++] = c;
-                consecutive_no_data = 0;
-            }
-        }
+    spin_lock(&uart_io_lock);
+    p = uart_io_proc_find(acct->pid);
+    if (p) {
+        list_move_tail(&p->node, &uart_io_procs);
+    } else {
+        p = fresh;
+        fresh = NULL;
+        p->pid = acct->pid;
+        list_add_tail(&p->node, &uart_io_procs);
         
-        // CHANGED: usleep_range instead of udelay
-        if (i > 0 && !uart_data_available()) {
-            usleep_range(1000, 1500);  // Sleep 1-1.5ms
-            consecutive_no_data++;
-            
-            if (consecutive_no_data >= MAX_CONSECUTIVE_NO_DATA) {
-                break;
+        if (++uart_io_nprocs > UART_IO_PROCS_MAX) {
+            list_for_each_entry(old, &uart_io_procs, node) {
+                if (!old->open_files) {
+                    break;
+                }
             }
-        } else if (i == 0 && !uart_data_available()) {
-            usleep_range(1000, 1500);  // Sleep 1-1.5ms
-            consecutive_no_data++;
-            if (consecutive_no_data >= MAX_CONSECUTIVE_NO_DATA) {
-                break;
+            if (&old->node != &uart_io_procs && old != p) {
+                list_del(&old->node);
+                uart_io_nprocs--;
+            } else {
+                old = NULL;
             }
         }
     }
+    memcpy(p->comm, acct->comm, sizeof(p->comm));
+    p->open_files++;
+    acct->proc = p;
+    list_add_tail(&acct->node, &uart_io_files);
+    spin_unlock(&uart_io_lock);
     
-    mutex_unlock(&uart_rx_mutex);
+    kfree(fresh);
+    kfree(old);
+    return 0;
+}
+
+static void uart_io_acct_del(struct uart_io_acct *acct)
+{
+    spin_lock(&uart_io_lock);
+    list_del(&acct->node);
+    uart_io_proc_fold(acct->proc, acct);
+    acct->proc->open_files--;
+    spin_unlock(&uart_io_lock);
+}
+
+static void uart_io_exit(void)
+{
+    struct uart_io_proc *p, *tmp;
     
-    if (i == 0) {
-        return 0;
+    list_for_each_entry_safe(p, tmp, &uart_io_procs, node) {
+        list_del(&p->node);
+        kfree(p);
     }
+}
+
+// RX history ring for /proc/uart_rx when rx_mode=service. Positions are
+// absolute stream offsets; each open file keeps its own read position, so
+// a reader that opens late can start from the retained history. Marks
+// record when each burst arrived, for time-based history and seeking.
+struct uart_rx_mark {
+    u64 ts_ns;   // estimated arrival of the burst's first byte
+    u64 pos;     // stream offset of the burst's first byte
+};
+
+// Stream position where data was lost before delivery, for record mode
+struct uart_rx_event {
+    u64 pos;     // stream offset of the first byte after the loss
+    u32 flags;   // UART_RX_REC_*
+};
+
+struct uart_rx_reader {
+    u64 pos;     // stream offset of the next byte to read
+    struct uart_io_acct acct;
     
-    kbuf[i] = '\0';
-    
-    if (copy_to_user(buf, kbuf, i)) {
-        stats.rx_errors++;
-        return -EFAULT;
-    }
+    // Message wakeup, when wake.mode is not UART_RX_WAKE_ANY
+    struct uart_rx_wake wake;
+    struct list_head node;     // on uart_rx_wake_readers
+    wait_queue_head_t wait;
+    u64 scan;                  // next byte to check for a delimiter
+    u64 msg_start;             // start of the message being assembled
+    u64 msg_end;               // its end once the length is known, else 0
+    u64 ready;                 // end of the last complete message
     
-    *ppos += i;
+    // Record mode (UART_IOC_RX_SET_RECORD)
+    bool record;
+    u64 ev_next;               // next event to report
+    u64 lost;                  // bytes dropped since the last record
+};
+
+static bool rx_service_mode;
+static u8 uart_rx_ring[UART_RX_BUF_SIZE];
+static u64 rx_head;          // bytes ever delivered to the ring
+static struct uart_rx_mark rx_marks[UART_RX_MARKS];
+static u64 rx_mark_head;     // marks ever written
+static struct uart_rx_event rx_events[UART_RX_EVENTS];
+static u64 rx_event_head;    // events ever written
+static size_t rx_overrun_at; // first overrun in the last drained burst
+static size_t rx_overrun_carry = SIZE_MAX;  // overrun past a full burst
+static bool rx_overrun_pending;  // mark the next delivered byte
+static u64 rx_arrival_ns;    // estimated arrival of the next undelivered byte
+static u32 rx_history_bytes = UART_RX_BUF_SIZE;
+static u32 rx_history_sec;   // 0: no time limit
+static DEFINE_SPINLOCK(uart_rx_lock);
+static DECLARE_WAIT_QUEUE_HEAD(uart_rx_wait);
+
+// Classic BPF RX filter (UART_IOC_ATTACH_FILTER on /proc/uart_rx). The
+// program sees each burst or decoded frame as packet data and returns a
+// UART_RX_TO_* mask; 0 drops the data before it is buffered. Attaching
+// needs CAP_NET_ADMIN, since the filter applies to every consumer.
+#define UART_FILTER_MAX_LEN 512  // the header documents this as 512
+
+static struct bpf_prog __rcu *uart_rx_filter;
+static struct sk_buff *uart_filter_skb;
+static DEFINE_MUTEX(uart_filter_mutex);
+
+// Time on the wire for one character at the current configuration
+static u64 uart_char_time_ns(void)
+{
+    u32 bits = (config.data_bits == DATA_BITS_8) ? 10 : 9;
     
-    pr_info("UART RX: received %d bytes\n", i);
-    return i;
+    return div_u64((u64)bits * NSEC_PER_SEC, config.baudrate);
 }
 
-// Proc file write handler for transmitting data
-static ssize_t uart_proc_write(struct file *file,
-    const char __user *buf, size_t count, loff_t *ppos)
+// Account a TX call that moved len bytes in elapsed_ns
+static void uart_io_acct_tx(struct uart_io_acct *acct, size_t len, u64 elapsed_ns)
 {
-    char kbuf[512];
-    size_t len;
+    u64 wire_ns = uart_char_time_ns() * len;
     
-    len = min(count, sizeof(kbuf) - 1);
-    
-    if (copy_from_user(kbuf, buf, len)) {
-        stats.tx_errors++;
-        return -EFAULT;
+    acct->ops++;
+    acct->bytes += len;
+    acct->block_ns += elapsed_ns;
+    if (elapsed_ns > wire_ns) {
+        acct->queue_ns += elapsed_ns - wire_ns;
     }
+}
+
+// Estimated arrival of the oldest of queued characters waiting in the RX
+// FIFO: they came in back to back at best, so it started on the wire at
+// least queued character times ago
+static u64 uart_rx_arrival_ns(u32 queued)
+{
+    return ktime_get_ns() - queued * uart_char_time_ns();
+}
+
+// Free slots in the TX FIFO
+static unsigned int uart_tx_fifo_space(void)
+{
+    u32 level = (readl(&uart->MU_STAT) >> 24) & 0xF;
     
-    kbuf[len] = '\0';
-    
-    uart_send_string(kbuf);
-    
-    pr_info("UART TX: sent %zu bytes\n", len);
-    
-    return count;
+    return level < UART_FIFO_DEPTH ? UART_FIFO_DEPTH - level : 0;
 }
 
-// Configuration read handler
-static ssize_t uart_config_read(struct file *file, char __user *buf,
-                                size_t count, loff_t *ppos)
+// Drain the RX FIFO without waiting
+static size_t uart_rx_drain(u8 *buf, size_t size)
 {
-    char kbuf[512];
-    int len;
+    size_t n = 0;
+    u32 lsr, level;
     
-    if (*ppos > 0) {
-        return 0;
+    rx_overrun_at = rx_overrun_carry;
+    rx_overrun_carry = SIZE_MAX;
+    while (n < size) {
+        lsr = readl(&uart->MU_LSR);
+        if (!(lsr & (1 << 0))) {
+            break;
+        }
+        if (n == 0) {
+            rx_arrival_ns = uart_rx_arrival_ns((readl(&uart->MU_STAT) >> 16) & 0xF);
+        }
+        if (lsr & (1 << 1)) {
+            // Bytes that arrived while the FIFO was full were discarded,
+            // so the loss sits after everything the FIFO still holds
+            level = (readl(&uart->MU_STAT) >> 16) & 0xF;
+            rx_overrun_at = min(rx_overrun_at, n + level);
+            stats.fifo_overruns++;
+            uart_cap_event(UART_CAP_EV_OVERRUN, UART_CAP_TRIG_OVERRUN);
+            pr_warn_ratelimited("UART RX FIFO overrun detected\n");
+        }
+        buf[n] = (u8)(readl(&uart->MU_IO) & 0xFF);
+        uart_cap_byte(UART_CAP_RX, buf[n++]);
     }
     
-    len = snprintf(kbuf, sizeof(kbuf),
-        "UART Configuration\n"
-        "==================\n"
-        "Baudrate: %u\n"
-        "Data bits: %s\n"
-        "System clock: %u Hz\n"
-        "\nSupported baud rates:\n"
-        "  9600, 19200, 38400, 57600, 115200\n"
-        "\nTo change configuration, write:\n"
-        "  echo \"baud=115200\" > /proc/uart_config\n"
-        "  echo \"bits=7\" > /proc/uart_config\n"
-        "  echo \"clear_fifo\" > /proc/uart_config\n",
-        config.baudrate,
-        (config.data_bits == DATA_BITS_8) ? "8" : "7",
-        config.system_clock);
-    
-    if (len > count) {
-        len = count;
+    // The burst filled before the FIFO emptied; mark the next one
+    if (rx_overrun_at != SIZE_MAX && rx_overrun_at > n) {
+        rx_overrun_carry = rx_overrun_at - n;
+        rx_overrun_at = SIZE_MAX;
     }
     
-    if (copy_to_user(buf, kbuf, len)) {
-        return -EFAULT;
+    stats.rx_bytes += n;
+    uart_flight_log(UART_CAP_RX, buf, n);
+    return n;
+}
+
+// Run the attached RX filter, if any, and return where the data goes
+static u32 uart_rx_filter_run(const u8 *data, size_t len)
+{
+    struct bpf_prog *prog;
+    u32 dest = UART_RX_TO_ALL;
+    
+    rcu_read_lock();
+    prog = rcu_dereference(uart_rx_filter);
+    if (prog) {
+        if (len > UART_FILTER_MAX_LEN) {
+            stats.rx_filter_truncated++;
+            len = UART_FILTER_MAX_LEN;
+        }
+        skb_trim(uart_filter_skb, 0);
+        skb_put_data(uart_filter_skb, data, len);
+        dest = bpf_prog_run_pin_on_cpu(prog, uart_filter_skb);
     }
+    rcu_read_unlock();
     
-    *ppos += len;
-    return len;
+    // Only the documented bits steer; a snapshot length means accept
+    return dest > UART_RX_TO_ALL ? UART_RX_TO_ALL : dest;
 }
 
-// Configuration write handler
-static ssize_t uart_config_write(struct file *file,
-    const char __user *buf, size_t count, loff_t *ppos)
+// Note a loss at pos; caller holds uart_rx_lock
+static void uart_rx_event_add(u64 pos, u32 flags)
 {
-    char kbuf[128];
+    struct uart_rx_event *ev = &rx_events[rx_event_head++ & (UART_RX_EVENTS - 1)];
+    
+    ev->pos = pos;
+    ev->flags = flags;
+}
+
+// Index of the first retained event at or after pos; caller holds
+// uart_rx_lock
+static u64 uart_rx_event_find(u64 pos)
+{
+    u64 lo = rx_event_head > UART_RX_EVENTS ? rx_event_head - UART_RX_EVENTS : 0;
+    u64 hi = rx_event_head;
+    u64 mid;
+    
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (rx_events[mid & (UART_RX_EVENTS - 1)].pos < pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo;
+}
+
+// Append a burst to the history ring, overwriting the oldest data
+static void uart_rx_ring_put(const u8 *data, size_t len)
+{
+    struct uart_rx_mark *mark;
+    size_t off, first;
+    u64 now, ts;
+    
+    spin_lock(&uart_rx_lock);
+    
+    // Marks stay ordered by time for uart_rx_ring_find()
+    now = ktime_get_ns();
+    ts = rx_arrival_ns && rx_arrival_ns < now ? rx_arrival_ns : now;
+    if (rx_mark_head) {
+        ts = max(ts, rx_marks[(rx_mark_head - 1) & (UART_RX_MARKS - 1)].ts_ns);
+    }
+    mark = &rx_marks[rx_mark_head++ & (UART_RX_MARKS - 1)];
+    mark->ts_ns = ts;
+    mark->pos = rx_head;
+    
+    // A burst split at an overrun resumes len characters later
+    if (rx_arrival_ns) {
+        rx_arrival_ns += len * uart_char_time_ns();
+    }
+    
+    if (rx_overrun_pending) {
+        uart_rx_event_add(rx_head, UART_RX_REC_OVERRUN);
+        rx_overrun_pending = false;
+    }
+    
+    if (len > UART_RX_BUF_SIZE) {
+        rx_head += len - UART_RX_BUF_SIZE;
+        data += len - UART_RX_BUF_SIZE;
+        len = UART_RX_BUF_SIZE;
+    }
+    
+    off = rx_head & (UART_RX_BUF_SIZE - 1);
+    first = min_t(size_t, len, UART_RX_BUF_SIZE - off);
+    memcpy(uart_rx_ring + off, data, first);
+    memcpy(uart_rx_ring, data + first, len - first);
+    rx_head += len;
+    
+    spin_unlock(&uart_rx_lock);
+}
+
+// Oldest stream offset still held in the ring; caller holds uart_rx_lock
+static u64 uart_rx_ring_tail(void)
+{
+    return rx_head > UART_RX_BUF_SIZE ? rx_head - UART_RX_BUF_SIZE : 0;
+}
+
+// Offset of the first burst delivered at or after ts_ns, or rx_head if
+// none; caller holds uart_rx_lock
+static u64 uart_rx_ring_find(u64 ts_ns)
+{
+    u64 lo = rx_mark_head > UART_RX_MARKS ? rx_mark_head - UART_RX_MARKS : 0;
+    u64 hi = rx_mark_head;
+    u64 mid;
+    
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (rx_marks[mid & (UART_RX_MARKS - 1)].ts_ns < ts_ns) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return lo < rx_mark_head ? rx_marks[lo & (UART_RX_MARKS - 1)].pos : rx_head;
+}
+
+// Oldest offset a new reader may start from under the history limits;
+// caller holds uart_rx_lock
+static u64 uart_rx_history_start(void)
+{
+    u64 start = rx_head > rx_history_bytes ? rx_head - rx_history_bytes : 0;
+    u64 now = ktime_get_ns();
+    u64 window = (u64)rx_history_sec * NSEC_PER_SEC;
+    
+    start = max(start, uart_rx_ring_tail());
+    if (rx_history_sec && now > window) {
+        start = max(start, uart_rx_ring_find(now - window));
+    }
+    
+    return start;
+}
+
+// ---------------------------------------------------------------------------
+// RX delivery latency (/proc/uart_latency)
+//
+// Each read that returns data records how long its first byte took from
+// arriving in the RX FIFO to being copied to user space, per RX mode and
+// baud rate. Arrival is not observable, so it is estimated at drain time
+// as now minus the FIFO level in character times: a lower bound when the
+// bytes sat in the FIFO, exact when they streamed in back to back.
+// Buckets are log-linear, four per power of two (within 25%), which is
+// fine enough to read p50/p99/p99.9 off the counts without keeping
+// samples.
+// ---------------------------------------------------------------------------
+
+#define UART_LAT_POLL     0
+#define UART_LAT_SERVICE  1
+#define UART_LAT_MODES    2
+#define UART_LAT_BAUDS    5
+#define UART_LAT_MAX_LOG  40   // ~18 minutes, anything above lands here
+#define UART_LAT_BUCKETS  (4 * UART_LAT_MAX_LOG + 4)
+
+static const u32 uart_lat_bauds[UART_LAT_BAUDS] = {
+    BAUD_9600, BAUD_19200, BAUD_38400, BAUD_57600, BAUD_115200
+};
+
+struct uart_lat_hist {
+    u64 count;
+    u64 max_ns;
+    u64 buckets[UART_LAT_BUCKETS];
+};
+
+static DEFINE_SPINLOCK(uart_lat_lock);
+static struct uart_lat_hist uart_lat[UART_LAT_MODES][UART_LAT_BAUDS];
+
+static u32 uart_lat_bucket(u64 ns)
+{
+    u32 msb;
+    
+    if (ns < 4) {
+        return (u32)ns;
+    }
+    
+    msb = ilog2(ns);
+    if (msb > UART_LAT_MAX_LOG) {
+        return UART_LAT_BUCKETS - 1;
+    }
+    return 4 * (msb - 1) + ((ns >> (msb - 2)) & 3);
+}
+
+// Largest value that falls in a bucket
+static u64 uart_lat_bucket_max(u32 idx)
+{
+    u32 msb;
+    
+    if (idx < 4) {
+        return idx;
+    }
+    
+    msb = idx / 4 + 1;
+    return ((u64)(4 + idx % 4) << (msb - 2)) + (1ULL << (msb - 2)) - 1;
+}
+
+static void uart_lat_record(u32 mode, u64 ns)
+{
+    struct uart_lat_hist *h;
+    u32 b;
+    
+    for (b = 0; b < UART_LAT_BAUDS; b++) {
+        if (uart_lat_bauds[b] == config.baudrate) {
+            break;
+        }
+    }
+    if (b == UART_LAT_BAUDS) {
+        return;
+    }
+    
+    h = &uart_lat[mode][b];
+    spin_lock(&uart_lat_lock);
+    h->count++;
+    h->max_ns = max(h->max_ns, ns);
+    h->buckets[uart_lat_bucket(ns)]++;
+    spin_unlock(&uart_lat_lock);
+}
+
+// Upper bound of the bucket holding the permille-th percentile sample
+static u64 uart_lat_percentile(const struct uart_lat_hist *h, u32 permille)
+{
+    u64 target = div_u64(h->count * permille + 999, 1000);
+    u64 seen = 0;
+    u32 i;
+    
+    for (i = 0; i < UART_LAT_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= target) {
+            return min(uart_lat_bucket_max(i), h->max_ns);
+        }
+    }
+    
+    return h->max_ns;
+}
+
+static void uart_lat_reset(void)
+{
+    spin_lock(&uart_lat_lock);
+    memset(uart_lat, 0, sizeof(uart_lat));
+    spin_unlock(&uart_lat_lock);
+}
+
+// Delivery time of the burst holding pos, or 0 if its mark was already
+// overwritten; caller holds uart_rx_lock
+static u64 uart_rx_mark_ts(u64 pos)
+{
+    u64 lo = rx_mark_head > UART_RX_MARKS ? rx_mark_head - UART_RX_MARKS : 0;
+    u64 hi = rx_mark_head;
+    u64 mid;
+    
+    if (lo == hi || rx_marks[lo & (UART_RX_MARKS - 1)].pos > pos) {
+        return 0;
+    }
+    
+    // Last mark at or before pos
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (rx_marks[mid & (UART_RX_MARKS - 1)].pos <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    
+    return rx_marks[lo & (UART_RX_MARKS - 1)].ts_ns;
+}
+
+// ---------------------------------------------------------------------------
+// Message-boundary reader wakeup (UART_IOC_RX_SET_WAKE)
+//
+// A reader with a wake condition sits on uart_rx_wake_readers with its own
+// wait queue. After each delivered burst the service thread advances every
+// such reader over the new bytes only, and wakes it when the end of its
+// last complete message (ready) moves. Those readers never see a partial
+// message, so they are woken once per message rather than once per burst.
+// All scan state is protected by uart_rx_lock.
+// ---------------------------------------------------------------------------
+
+static LIST_HEAD(uart_rx_wake_readers);
+
+static inline u8 uart_rx_ring_byte(u64 pos)
+{
+    return uart_rx_ring[pos & (UART_RX_BUF_SIZE - 1)];
+}
+
+// Move a reader's message boundaries forward over buffered data
+static void uart_rx_wake_advance(struct uart_rx_reader *r)
+{
+    const struct uart_rx_wake *w = &r->wake;
+    u64 field_pos, hdr_end;
+    s64 end;
+    u32 field, i;
+    u8 b;
+    
+    switch (w->mode) {
+    case UART_RX_WAKE_DELIM:
+        for (; r->scan < rx_head; r->scan++) {
+            if (uart_rx_ring_byte(r->scan) == w->delim) {
+                r->msg_start = r->scan + 1;
+                r->ready = r->msg_start;
+            }
+        }
+        break;
+    case UART_RX_WAKE_FIXED:
+        while (rx_head - r->msg_start >= w->frame_size) {
+            r->msg_start += w->frame_size;
+        }
+        r->ready = r->msg_start;
+        break;
+    case UART_RX_WAKE_LENGTH:
+        for (;;) {
+            field_pos = r->msg_start + w->len_offset;
+            hdr_end = field_pos + w->len_size;
+            if (!r->msg_end) {
+                if (rx_head < hdr_end) {
+                    break;
+                }
+                field = 0;
+                for (i = 0; i < w->len_size; i++) {
+                    b = uart_rx_ring_byte(field_pos + i);
+                    field = w->len_be ? (field << 8) | b : field | ((u32)b << (8 * i));
+                }
+                // A nonsense length still consumes at least the header
+                end = (s64)(hdr_end + field) + w->len_adjust;
+                r->msg_end = max_t(s64, end, hdr_end);
+            }
+            if (rx_head < r->msg_end) {
+                break;
+            }
+            r->msg_start = r->msg_end;
+            r->ready = r->msg_start;
+            r->msg_end = 0;
+        }
+        break;
+    }
+}
+
+// Restart message tracking at pos; caller holds uart_rx_lock
+static void uart_rx_wake_reset(struct uart_rx_reader *r, u64 pos)
+{
+    r->scan = pos;
+    r->msg_start = pos;
+    r->msg_end = 0;
+    r->ready = pos;
+    uart_rx_wake_advance(r);
+}
+
+// Service path: advance all message readers over the newest burst
+static void uart_rx_wake_scan(void)
+{
+    struct uart_rx_reader *r;
+    u64 tail, old;
+    
+    spin_lock(&uart_rx_lock);
+    tail = uart_rx_ring_tail();
+    list_for_each_entry(r, &uart_rx_wake_readers, node) {
+        old = r->ready;
+        if (r->msg_start < tail) {
+            // The message in progress was overwritten; resynchronise
+            uart_rx_wake_reset(r, tail);
+        } else {
+            uart_rx_wake_advance(r);
+        }
+        if (r->ready != old) {
+            wake_up_interruptible(&r->wait);
+        }
+    }
+    spin_unlock(&uart_rx_lock);
+}
+
+// Wake every message reader, e.g. when the service mode goes away
+static void uart_rx_wake_all(void)
+{
+    struct uart_rx_reader *r;
+    
+    spin_lock(&uart_rx_lock);
+    list_for_each_entry(r, &uart_rx_wake_readers, node) {
+        wake_up_interruptible(&r->wait);
+    }
+    spin_unlock(&uart_rx_lock);
+}
+
+// End of what a reader may consume now
+static u64 uart_rx_readable(const struct uart_rx_reader *r)
+{
+    return r->wake.mode == UART_RX_WAKE_ANY ? READ_ONCE(rx_head) : READ_ONCE(r->ready);
+}
+
+// Deliver RX data to the client and the /proc reader buffer
+static void uart_rx_deliver(const u8 *data, size_t len)
+{
+    u32 dest;
+    
+    dest = uart_rx_filter_run(data, len);
+    if (!(dest & UART_RX_TO_ALL)) {
+        stats.rx_filter_drops += len;
+        return;
+    }
+    
+    if (dest & UART_RX_TO_CLIENT) {
+        mutex_lock(&uart_client_mutex);
+        if (uart_client && uart_client->rx) {
+            uart_client->rx(uart_client, data, len);
+        }
+        mutex_unlock(&uart_client_mutex);
+    }
+    
+    if (rx_service_mode && (dest & UART_RX_TO_READER)) {
+        uart_rx_ring_put(data, len);
+        wake_up_interruptible(&uart_rx_wait);
+        if (!list_empty(&uart_rx_wake_readers)) {
+            uart_rx_wake_scan();
+        }
+    }
+    rx_overrun_pending = false;
+}
+
+// ---------------------------------------------------------------------------
+// SLIP framing helpers (RFC 1055 byte stuffing)
+// ---------------------------------------------------------------------------
+
+struct uart_slip_rx {
+    u8 *buf;
+    size_t size;
+    size_t len;
+    bool esc;
+    bool overflow;
+};
+
+// Encode a frame into dst, which must hold 2 * len + 2 bytes
+static size_t uart_slip_encode(const u8 *src, size_t len, u8 *dst)
+{
+    size_t n = 0;
+    size_t i;
+    
+    dst[n++] = SLIP_END;
+    for (i = 0; i < len; i++) {
+        if (src[i] == SLIP_END) {
+            dst[n++] = SLIP_ESC;
+            dst[n++] = SLIP_ESC_END;
+        } else if (src[i] == SLIP_ESC) {
+            dst[n++] = SLIP_ESC;
+            dst[n++] = SLIP_ESC_ESC;
+        } else {
+            dst[n++] = src[i];
+        }
+    }
+    dst[n++] = SLIP_END;
+    
+    return n;
+}
+
+// Drop any partial frame, as when a decoder is brought back into use
+static void uart_slip_rx_reset(struct uart_slip_rx *rx)
+{
+    rx->len = 0;
+    rx->esc = false;
+    rx->overflow = false;
+}
+
+// Feed one byte to a decoder. Returns the length of a frame completed by
+// this byte, left in rx->buf until the next call, or 0 otherwise.
+static size_t uart_slip_rx_byte(struct uart_slip_rx *rx, u8 c)
+{
+    size_t len;
+    
+    if (c == SLIP_END) {
+        len = rx->overflow ? 0 : rx->len;
+        rx->len = 0;
+        rx->esc = false;
+        rx->overflow = false;
+        return len;
+    }
+    
+    if (c == SLIP_ESC) {
+        rx->esc = true;
+        return 0;
+    }
+    
+    if (rx->esc) {
+        rx->esc = false;
+        if (c == SLIP_ESC_END) {
+            c = SLIP_END;
+        } else if (c == SLIP_ESC_ESC) {
+            c = SLIP_ESC;
+        }
+    }
+    
+    if (rx->len < rx->size) {
+        rx->buf[rx->len++] = c;
+    } else {
+        rx->overflow = true;
+    }
+    
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Link compression (compress=lz4)
+//
+// Each /proc/uart_tx write becomes one SLIP frame:
+//   type(1) | raw length(2, LE) | payload | crc16(2, LE)
+// where the payload is an LZ4 block, or the raw bytes when LZ4 does not
+// shrink them. The service thread decodes frames from the peer and
+// delivers the decompressed data to readers.
+// ---------------------------------------------------------------------------
+
+#define UART_COMP_MAX_RAW    512
+#define UART_COMP_HDR_LEN    3
+#define UART_COMP_MAX_FRAME  (UART_COMP_HDR_LEN + LZ4_COMPRESSBOUND(UART_COMP_MAX_RAW) + 2)
+#define UART_COMP_STORED     0
+#define UART_COMP_LZ4        1
+
+static bool compress_mode;
+
+// Encoder scratch, separate from uart_tx_mutex so client writes can be
+// encoded from a TX completion callback, which runs under that mutex
+static DEFINE_MUTEX(uart_comp_enc_mutex);
+static u8 comp_wrkmem[LZ4_MEM_COMPRESS] __aligned(8);
+static u8 comp_tx_frame[UART_COMP_MAX_FRAME];
+static u8 comp_tx_wire[2 * UART_COMP_MAX_FRAME + 2];
+static u8 comp_rx_frame[UART_COMP_MAX_FRAME];
+static u8 comp_rx_raw[UART_COMP_MAX_RAW];
+static struct uart_slip_rx comp_rx = {
+    .buf = comp_rx_frame,
+    .size = sizeof(comp_rx_frame),
+};
+
+// Compress up to UART_COMP_MAX_RAW bytes into a SLIP-framed packet at
+// wire, which must hold sizeof(comp_tx_wire)
+static size_t uart_comp_encode(const u8 *data, size_t len, u8 *wire)
+{
+    int clen;
+    size_t flen, wlen;
+    u16 crc;
+    u64 t0 = local_clock();
+    
+    mutex_lock(&uart_comp_enc_mutex);
+    clen = LZ4_compress_default((const char *)data,
+                                (char *)comp_tx_frame + UART_COMP_HDR_LEN,
+                                len, LZ4_COMPRESSBOUND(UART_COMP_MAX_RAW),
+                                comp_wrkmem);
+    if (clen > 0 && clen < len) {
+        comp_tx_frame[0] = UART_COMP_LZ4;
+    } else {
+        comp_tx_frame[0] = UART_COMP_STORED;
+        memcpy(comp_tx_frame + UART_COMP_HDR_LEN, data, len);
+        clen = len;
+    }
+    comp_tx_frame[1] = len & 0xFF;
+    comp_tx_frame[2] = (len >> 8) & 0xFF;
+    
+    flen = UART_COMP_HDR_LEN + clen;
+    crc = crc16(0, comp_tx_frame, flen);
+    comp_tx_frame[flen++] = crc & 0xFF;
+    comp_tx_frame[flen++] = crc >> 8;
+    
+    wlen = uart_slip_encode(comp_tx_frame, flen, wire);
+    mutex_unlock(&uart_comp_enc_mutex);
+    cost.comp_ns += local_clock() - t0;
+    
+    stats.comp_tx_raw += len;
+    stats.comp_tx_wire += wlen;
+    return wlen;
+}
+
+// Compress and send one write as a frame
+static void uart_comp_send(const u8 *data, size_t len)
+{
+    size_t wlen;
+    
+    mutex_lock(&uart_tx_mutex);
+    wlen = uart_comp_encode(data, len, comp_tx_wire);
+    uart_send_raw_locked(comp_tx_wire, wlen);
+    mutex_unlock(&uart_tx_mutex);
+}
+
+// Check and unpack one received frame, then deliver its data
+static void uart_comp_rx_frame(const u8 *frame, size_t len)
+{
+    size_t raw_len, plen;
+    u16 crc;
+    int ret;
+    u64 t0 = local_clock();
+    
+    if (len < UART_COMP_HDR_LEN + 2) {
+        goto bad;
+    }
+    
+    crc = frame[len - 2] | (frame[len - 1] << 8);
+    if (crc16(0, frame, len - 2) != crc) {
+        goto bad;
+    }
+    
+    raw_len = frame[1] | (frame[2] << 8);
+    plen = len - UART_COMP_HDR_LEN - 2;
+    if (raw_len > UART_COMP_MAX_RAW) {
+        goto bad;
+    }
+    
+    if (frame[0] == UART_COMP_STORED && plen == raw_len) {
+        memcpy(comp_rx_raw, frame + UART_COMP_HDR_LEN, raw_len);
+    } else if (frame[0] == UART_COMP_LZ4) {
+        ret = LZ4_decompress_safe((const char *)frame + UART_COMP_HDR_LEN,
+                                  (char *)comp_rx_raw,
+                                  plen, UART_COMP_MAX_RAW);
+        if (ret != raw_len) {
+            goto bad;
+        }
+    } else {
+        goto bad;
+    }
+    
+    cost.decomp_ns += local_clock() - t0;
+    stats.comp_rx_raw += raw_len;
+    uart_rx_deliver(comp_rx_raw, raw_len);
+    return;
+    
+bad:
+    cost.decomp_ns += local_clock() - t0;
+    stats.comp_rx_errors++;
+}
+
+// Run received wire bytes through the frame decoder
+static void uart_comp_rx(const u8 *data, size_t len)
+{
+    size_t i, flen;
+    
+    stats.comp_rx_wire += len;
+    for (i = 0; i < len; i++) {
+        flen = uart_slip_rx_byte(&comp_rx, data[i]);
+        if (flen) {
+            uart_comp_rx_frame(comp_rx_frame, flen);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// SLIP network interface (net=on)
+//
+// Registers slmu<N> and carries IP packets as SLIP frames. The service
+// thread decodes RX frames into skbs and hands them to NAPI; transmit
+// packets are queued by ndo_start_xmit and fed into the TX FIFO by the
+// service thread, with byte queue limits tracking what is in flight.
+// ---------------------------------------------------------------------------
+
+#define UART_NET_MTU      296
+#define UART_NET_MAX_MTU  1500
+#define UART_NET_TXQ_MAX  16
+#define UART_NET_RXQ_MAX  64
+#define UART_NET_WEIGHT   16
+
+static struct net_device __rcu *uart_net_dev;
+static struct napi_struct uart_napi;
+static struct sk_buff_head uart_net_rxq;
+static struct sk_buff_head uart_net_txq;
+static DEFINE_MUTEX(uart_net_mutex);  // serializes net=on/off
+
+static u8 net_rx_frame[UART_NET_MAX_MTU];
+static struct uart_slip_rx net_rx = {
+    .buf = net_rx_frame,
+    .size = sizeof(net_rx_frame),
+};
+
+// Encoded packet currently being fed into the TX FIFO
+static u8 net_tx_wire[2 * UART_NET_MAX_MTU + 2];
+static size_t net_tx_len;
+static size_t net_tx_pos;
+static unsigned int net_tx_bytes;
+
+// Turn one decoded frame into an skb for the stack
+static void uart_net_rx_frame(struct net_device *dev, const u8 *frame,
+                              size_t len)
+{
+    struct sk_buff *skb;
+    
+    // NAPI only drains the queue while the interface is up
+    if (!netif_running(dev) ||
+        skb_queue_len(&uart_net_rxq) >= UART_NET_RXQ_MAX) {
+        dev->stats.rx_dropped++;
+        return;
+    }
+    
+    if (len > dev->mtu) {
+        dev->stats.rx_length_errors++;
+        dev->stats.rx_errors++;
+        return;
+    }
+    
+    skb = netdev_alloc_skb(dev, len);
+    if (!skb) {
+        dev->stats.rx_dropped++;
+        return;
+    }
+    
+    skb_put_data(skb, frame, len);
+    skb->protocol = ((frame[0] >> 4) == 6) ? htons(ETH_P_IPV6) : htons(ETH_P_IP);
+    skb_reset_network_header(skb);
+    skb_queue_tail(&uart_net_rxq, skb);
+    
+    dev->stats.rx_packets++;
+    dev->stats.rx_bytes += len;
+}
+
+// Service path RX: decode the burst and schedule NAPI for new packets
+static void uart_net_rx(const u8 *data, size_t len)
+{
+    struct net_device *dev;
+    size_t i, flen;
+    bool queued = false;
+    
+    rcu_read_lock();
+    dev = rcu_dereference(uart_net_dev);
+    if (!dev) {
+        rcu_read_unlock();
+        return;
+    }
+    
+    // The frame in progress lost bytes to an RX FIFO overrun
+    if (rx_overrun_pending) {
+        dev->stats.rx_over_errors++;
+        dev->stats.rx_errors++;
+    }
+    
+    for (i = 0; i < len; i++) {
+        flen = uart_slip_rx_byte(&net_rx, data[i]);
+        if (flen) {
+            uart_net_rx_frame(dev, net_rx_frame, flen);
+            queued = true;
+        }
+    }
+    
+    if (queued) {
+        local_bh_disable();
+        napi_schedule(&uart_napi);
+        local_bh_enable();
+    }
+    rcu_read_unlock();
+}
+
+static int uart_net_poll(struct napi_struct *napi, int budget)
+{
+    struct sk_buff *skb;
+    int done = 0;
+    
+    while (done < budget && (skb = skb_dequeue(&uart_net_rxq)) != NULL) {
+        netif_receive_skb(skb);
+        done++;
+    }
+    
+    if (done < budget && napi_complete_done(napi, done) &&
+        !skb_queue_empty(&uart_net_rxq)) {
+        napi_schedule(napi);
+    }
+    
+    return done;
+}
+
+// Service path TX: feed the current packet, starting the next if needed
+static size_t uart_net_tx(unsigned int space)
+{
+    struct net_device *dev;
+    struct sk_buff *skb;
+    size_t sent = 0;
+    
+    rcu_read_lock();
+    dev = rcu_dereference(uart_net_dev);
+    while (dev && space) {
+        if (!net_tx_len) {
+            skb = skb_dequeue(&uart_net_txq);
+            if (!skb) {
+                break;
+            }
+            net_tx_len = uart_slip_encode(skb->data, skb->len, net_tx_wire);
+            net_tx_pos = 0;
+            net_tx_bytes = skb->len;
+            dev_consume_skb_any(skb);
+        }
+        
+        while (space && net_tx_pos < net_tx_len) {
+            writel(net_tx_wire[net_tx_pos], &uart->MU_IO);
+            uart_cap_byte(UART_CAP_TX, net_tx_wire[net_tx_pos++]);
+            space--;
+            sent++;
+        }
+        
+        if (net_tx_pos < net_tx_len) {
+            break;
+        }
+        
+        uart_flight_log(UART_CAP_TX, net_tx_wire, net_tx_len);
+        dev->stats.tx_packets++;
+        dev->stats.tx_bytes += net_tx_bytes;
+        netdev_completed_queue(dev, 1, net_tx_bytes);
+        net_tx_len = 0;
+        
+        if (netif_queue_stopped(dev) &&
+            skb_queue_len(&uart_net_txq) < UART_NET_TXQ_MAX / 2) {
+            netif_wake_queue(dev);
+        }
+    }
+    rcu_read_unlock();
+    
+    return sent;
+}
+
+static netdev_tx_t uart_net_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+    if (skb_linearize(skb)) {
+        dev->stats.tx_dropped++;
+        dev_kfree_skb_any(skb);
+        return NETDEV_TX_OK;
+    }
+    
+    netdev_sent_queue(dev, skb->len);
+    skb_queue_tail(&uart_net_txq, skb);
+    if (skb_queue_len(&uart_net_txq) >= UART_NET_TXQ_MAX) {
+        netif_stop_queue(dev);
+    }
+    
+    return NETDEV_TX_OK;
+}
+
+static int uart_net_open(struct net_device *dev)
+{
+    napi_enable(&uart_napi);
+    netdev_reset_queue(dev);
+    netif_start_queue(dev);
+    return 0;
+}
+
+static int uart_net_stop(struct net_device *dev)
+{
+    netif_stop_queue(dev);
+    napi_disable(&uart_napi);
+    
+    // Drop whatever is in flight, so nothing completes against the byte
+    // queue after the next open resets it
+    mutex_lock(&uart_tx_mutex);
+    if (net_tx_len) {
+        dev->stats.tx_dropped++;
+    }
+    net_tx_len = 0;
+    net_tx_bytes = 0;
+    skb_queue_purge(&uart_net_txq);
+    mutex_unlock(&uart_tx_mutex);
+    
+    skb_queue_purge(&uart_net_rxq);
+    return 0;
+}
+
+static const struct net_device_ops uart_net_ops = {
+    .ndo_open       = uart_net_open,
+    .ndo_stop       = uart_net_stop,
+    .ndo_start_xmit = uart_net_xmit,
+};
+
+static void uart_net_setup(struct net_device *dev)
+{
+    dev->netdev_ops = &uart_net_ops;
+    dev->type = ARPHRD_SLIP;
+    dev->hard_header_len = 0;
+    dev->addr_len = 0;
+    dev->mtu = UART_NET_MTU;
+    dev->min_mtu = 68;
+    dev->max_mtu = UART_NET_MAX_MTU;
+    dev->tx_queue_len = 10;
+    dev->flags = IFF_NOARP | IFF_POINTOPOINT | IFF_MULTICAST;
+}
+
+// ---------------------------------------------------------------------------
+// Auto-response table (autoresp=<slot>:<match>:<response>)
+//
+// The raw RX stream is checked against each slot's match bytes as it is
+// drained. On a hit the slot's response is copied out under uart_ar_lock
+// and sent by the same service pass, ahead of queued TX, so the reply
+// leaves within a few character times without involving user space.
+// Matched bytes are still delivered to readers as usual.
+// ---------------------------------------------------------------------------
+
+#define UART_AR_SLOTS      8
+#define UART_AR_MATCH_MAX  32
+#define UART_AR_RESP_MAX   256
+
+struct uart_ar_slot {
+    u8 match[UART_AR_MATCH_MAX];
+    u8 resp[UART_AR_RESP_MAX];
+    u32 match_len;  // 0 when the slot is unused
+    u32 resp_len;
+    u64 hits;
+};
+
+static DEFINE_SPINLOCK(uart_ar_lock);
+static struct uart_ar_slot uart_ar_table[UART_AR_SLOTS];
+static u32 uart_ar_active;  // slots in use
+
+// Most recent RX bytes, service thread only
+static u8 uart_ar_window[UART_AR_MATCH_MAX];
+static u32 uart_ar_window_len;
+
+// Response waiting for the TX FIFO, service thread only
+static u8 uart_ar_tx[UART_AR_RESP_MAX];
+static u32 uart_ar_tx_len;
+static u32 uart_ar_tx_pos;
+
+// Return the first slot whose match ends at the newest window byte
+static struct uart_ar_slot *uart_ar_lookup(void)
+{
+    struct uart_ar_slot *slot;
+    u32 i;
+    
+    for (i = 0; i < UART_AR_SLOTS; i++) {
+        slot = &uart_ar_table[i];
+        if (slot->match_len && slot->match_len <= uart_ar_window_len &&
+            memcmp(uart_ar_window + uart_ar_window_len - slot->match_len,
+                   slot->match, slot->match_len) == 0) {
+            return slot;
+        }
+    }
+    
+    return NULL;
+}
+
+static void uart_ar_rx(const u8 *data, size_t len)
+{
+    struct uart_ar_slot *slot;
+    size_t i;
+    
+    spin_lock(&uart_ar_lock);
+    for (i = 0; i < len; i++) {
+        if (uart_ar_window_len == UART_AR_MATCH_MAX) {
+            memmove(uart_ar_window, uart_ar_window + 1, UART_AR_MATCH_MAX - 1);
+            uart_ar_window_len--;
+        }
+        uart_ar_window[uart_ar_window_len++] = data[i];
+        
+        slot = uart_ar_lookup();
+        if (!slot) {
+            continue;
+        }
+        
+        slot->hits++;
+        uart_ar_window_len = 0;
+        if (uart_ar_tx_len) {
+            stats.ar_busy++;
+            continue;
+        }
+        memcpy(uart_ar_tx, slot->resp, slot->resp_len);
+        uart_ar_tx_len = slot->resp_len;
+        uart_ar_tx_pos = 0;
+    }
+    spin_unlock(&uart_ar_lock);
+}
+
+// Feed a pending response into the TX FIFO. Returns true while one is
+// still in progress, in which case nothing else may transmit.
+static bool uart_ar_tx_service(unsigned int *space, size_t *sent)
+{
+    u32 start = uart_ar_tx_pos;
+    
+    if (!uart_ar_tx_len) {
+        return false;
+    }
+    
+    while (*space && uart_ar_tx_pos < uart_ar_tx_len) {
+        writel(uart_ar_tx[uart_ar_tx_pos], &uart->MU_IO);
+        uart_cap_byte(UART_CAP_TX, uart_ar_tx[uart_ar_tx_pos++]);
+        (*space)--;
+        (*sent)++;
+    }
+    uart_flight_log(UART_CAP_TX, uart_ar_tx + start, uart_ar_tx_pos - start);
+    
+    if (uart_ar_tx_pos < uart_ar_tx_len) {
+        return true;
+    }
+    
+    stats.ar_responses++;
+    uart_ar_tx_len = 0;
+    return false;
+}
+
+// Parse "<slot>:<match hex>:<response hex>" and install it atomically.
+// An empty match clears the slot.
+static int uart_ar_set(char *arg)
+{
+    u8 match[UART_AR_MATCH_MAX];
+    u8 *resp;
+    char *slot_str, *match_hex, *resp_hex;
+    size_t mlen, rlen;
+    u32 slot;
+    int ret = 0;
+    
+    slot_str = strsep(&arg, ":");
+    match_hex = strsep(&arg, ":");
+    resp_hex = arg ? arg : "";
+    if (!match_hex || kstrtou32(slot_str, 10, &slot) || slot >= UART_AR_SLOTS) {
+        return -EINVAL;
+    }
+    
+    mlen = strlen(match_hex);
+    rlen = strlen(resp_hex);
+    if (mlen % 2 || rlen % 2 || mlen / 2 > UART_AR_MATCH_MAX ||
+        rlen / 2 > UART_AR_RESP_MAX || (mlen && !rlen)) {
+        return -EINVAL;
+    }
+    mlen /= 2;
+    rlen /= 2;
+    
+    resp = kmalloc(UART_AR_RESP_MAX, GFP_KERNEL);
+    if (!resp) {
+        return -ENOMEM;
+    }
+    
+    if (hex2bin(match, match_hex, mlen) || hex2bin(resp, resp_hex, rlen)) {
+        ret = -EINVAL;
+        goto out;
+    }
+    
+    spin_lock(&uart_ar_lock);
+    if (!uart_ar_table[slot].match_len && mlen) {
+        uart_ar_active++;
+    } else if (uart_ar_table[slot].match_len && !mlen) {
+        uart_ar_active--;
+    }
+    memcpy(uart_ar_table[slot].match, match, mlen);
+    memcpy(uart_ar_table[slot].resp, resp, rlen);
+    uart_ar_table[slot].match_len = mlen;
+    uart_ar_table[slot].resp_len = rlen;
+    uart_ar_table[slot].hits = 0;
+    spin_unlock(&uart_ar_lock);
+    
+out:
+    kfree(resp);
+    return ret;
+}
+
+// Empty every slot
+static void uart_ar_clear(void)
+{
+    spin_lock(&uart_ar_lock);
+    memset(uart_ar_table, 0, sizeof(uart_ar_table));
+    uart_ar_active = 0;
+    uart_ar_window_len = 0;
+    spin_unlock(&uart_ar_lock);
+}
+
+// ---------------------------------------------------------------------------
+// Multi-drop address filter (addr_filter=...)
+//
+// Raw RX bytes are grouped into frames separated by line idle time
+// (addr_gap character times, Modbus RTU style). Bytes are only seen when
+// a service pass drains the FIFO, so a burst's first byte is dated back
+// by its length in character times, and the service thread polls at
+// least twice per gap while the filter is on. A finished frame is kept
+// only if the byte at addr_offset is one of our addresses or the
+// broadcast address; everything else is dropped before buffering. A frame
+// longer than the buffer goes out in pieces that share the first piece's
+// verdict. The frame state belongs to the service thread; the address
+// list is published under uart_rx_lock.
+// ---------------------------------------------------------------------------
+
+#define UART_ADDR_MAX        8
+#define UART_ADDR_FRAME_MAX  256
+#define UART_ADDR_NONE       0x100  // no broadcast address
+#define UART_ADDR_GAP_MIN    2      // character times
+
+static bool addr_filter_mode;
+static u8 addr_list[UART_ADDR_MAX];
+static u32 addr_count;
+static u32 addr_offset;
+static u32 addr_broadcast;  // Modbus broadcast by default
+static u32 addr_gap_chars = 4;
+
+static u8 addr_frame[UART_ADDR_FRAME_MAX];
+static size_t addr_frame_len;
+static int addr_verdict = -1;  // for the rest of a long frame; -1: none yet
+static bool addr_reset;        // drop the frame in progress on the next pass
+static u64 addr_last_rx_ns;  // when the last burst was drained
+
+static bool uart_addr_match(const u8 *frame, size_t len)
+{
+    bool match;
+    u8 addr;
+    u32 i;
+    
+    if (addr_offset >= len) {
+        return false;
+    }
+    
+    addr = frame[addr_offset];
+    spin_lock(&uart_rx_lock);
+    match = addr == addr_broadcast;
+    for (i = 0; i < addr_count && !match; i++) {
+        match = addr == addr_list[i];
+    }
+    spin_unlock(&uart_rx_lock);
+    
+    return match;
+}
+
+// Pass or drop the buffered bytes. Unless the frame ends here, its
+// verdict carries over to the pieces that follow.
+static void uart_addr_emit(bool frame_end)
+{
+    bool keep;
+    
+    if (addr_frame_len) {
+        if (addr_verdict < 0) {
+            keep = uart_addr_match(addr_frame, addr_frame_len);
+            if (keep) {
+                stats.addr_accepted++;
+            } else {
+                stats.addr_filtered++;
+            }
+        } else {
+            keep = addr_verdict;
+        }
+        
+        if (keep) {
+            uart_rx_deliver(addr_frame, addr_frame_len);
+        }
+        addr_frame_len = 0;
+        addr_verdict = keep;
+    }
+    
+    if (frame_end) {
+        addr_verdict = -1;
+    }
+}
+
+// Finish the frame in progress and pass or drop it
+static void uart_addr_flush(void)
+{
+    uart_addr_emit(true);
+}
+
+// Forget the frame in progress if the configuration changed under it
+static void uart_addr_check_reset(void)
+{
+    if (READ_ONCE(addr_reset)) {
+        WRITE_ONCE(addr_reset, false);
+        addr_frame_len = 0;
+        addr_verdict = -1;
+    }
+}
+
+// Install a new address list from process context
+static void uart_addr_set(const u8 *list, u32 count)
+{
+    spin_lock(&uart_rx_lock);
+    memcpy(addr_list, list, count);
+    addr_count = count;
+    spin_unlock(&uart_rx_lock);
+    WRITE_ONCE(addr_reset, true);
+}
+
+static void uart_addr_rx(const u8 *data, size_t len)
+{
+    u64 now = local_clock();
+    u64 char_ns = uart_char_time_ns();
+    u64 first_ns;
+    size_t chunk;
+    
+    uart_addr_check_reset();
+    
+    // The FIFO was empty at the last drain, and a continuous stream puts
+    // this burst's first byte about one character after it. Idle time
+    // between the two means a new frame starts here.
+    first_ns = now - min_t(u64, now, len * char_ns);
+    if (first_ns > addr_last_rx_ns + char_ns * addr_gap_chars) {
+        uart_addr_flush();
+    }
+    addr_last_rx_ns = now;
+    
+    while (len) {
+        chunk = min(len, UART_ADDR_FRAME_MAX - addr_frame_len);
+        memcpy(addr_frame + addr_frame_len, data, chunk);
+        addr_frame_len += chunk;
+        data += chunk;
+        len -= chunk;
+        
+        if (addr_frame_len == UART_ADDR_FRAME_MAX) {
+            uart_addr_emit(false);
+        }
+    }
+}
+
+// Called when a service pass found the RX FIFO empty
+static void uart_addr_idle(void)
+{
+    uart_addr_check_reset();
+    if ((addr_frame_len || addr_verdict >= 0) &&
+        local_clock() - addr_last_rx_ns > uart_char_time_ns() * addr_gap_chars) {
+        uart_addr_flush();
+    }
+}
+
+// Parse "a,b,c" (decimal or 0x hex) into up to UART_ADDR_MAX addresses
+static int uart_addr_parse(char *list, u8 *out, u32 *count)
+{
+    u8 addrs[UART_ADDR_MAX];
+    u32 n = 0;
+    char *tok;
+    
+    while ((tok = strsep(&list, ",")) != NULL) {
+        if (n == UART_ADDR_MAX || kstrtou8(tok, 0, &addrs[n])) {
+            return -EINVAL;
+        }
+        n++;
+    }
+    
+    memcpy(out, addrs, n);
+    *count = n;
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Remote loopback (echo=on)
+//
+// Every received byte is queued straight back to TX by the service thread
+// instead of going to readers. The ring is only touched by the service
+// thread, so it needs no lock; it only fills if TX is held up by a
+// /proc/uart_tx writer, in which case the excess is counted and dropped.
+// ---------------------------------------------------------------------------
+
+#define UART_ECHO_RING_SIZE  4096  // power of two
+
+static bool echo_mode;
+static u8 uart_echo_ring[UART_ECHO_RING_SIZE];
+static unsigned int uart_echo_head;
+static unsigned int uart_echo_tail;
+
+static void uart_echo_rx(const u8 *data, size_t len)
+{
+    size_t i;
+    
+    for (i = 0; i < len; i++) {
+        if (uart_echo_head - uart_echo_tail == UART_ECHO_RING_SIZE) {
+            stats.echo_drops += len - i;
+            break;
+        }
+        uart_echo_ring[uart_echo_head++ & (UART_ECHO_RING_SIZE - 1)] = data[i];
+    }
+}
+
+// Feed queued echo bytes into the TX FIFO
+static size_t uart_echo_tx(unsigned int space)
+{
+    size_t sent = 0;
+    u8 c;
+    
+    while (space-- && uart_echo_tail != uart_echo_head) {
+        c = uart_echo_ring[uart_echo_tail++ & (UART_ECHO_RING_SIZE - 1)];
+        writel(c, &uart->MU_IO);
+        uart_cap_byte(UART_CAP_TX, c);
+        sent++;
+    }
+    
+    stats.echo_bytes += sent;
+    return sent;
+}
+
+// ---------------------------------------------------------------------------
+// Bit error rate tester (bert_tx=..., bert_rx=...)
+//
+// The generator fills whatever TX FIFO space is left after all other
+// traffic with a PRBS stream, so it runs at line rate. The checker takes
+// over RX from the readers: it loads its shift register from received bits
+// until 2 * order consecutive bits are predicted correctly, then compares
+// against its own sequence so one bad bit is counted once. More than a
+// quarter of a 256-bit window in error drops lock and counts a resync.
+// Bits go out LSB first, data_bits per character, like the line itself.
+// ---------------------------------------------------------------------------
+
+#define UART_BERT_WINDOW      256
+#define UART_BERT_WINDOW_BAD  64
+
+// PRBS polynomial x^order + x^tap + 1 (ITU-T O.150); order 0 when off
+struct uart_bert {
+    u32 order;
+    u32 tap;
+    u32 reg;
+};
+
+static struct uart_bert bert_gen;     // under uart_tx_mutex
+static DEFINE_SPINLOCK(uart_bert_lock);  // checker state
+static struct uart_bert bert_chk;
+static bool bert_locked;
+static u32 bert_good;
+static u32 bert_win_bits;
+static u32 bert_win_errs;
+static u64 bert_tx_start_ns;
+static u64 bert_rx_start_ns;
+
+static int uart_bert_parse(const char *name, struct uart_bert *b)
+{
+    if (strcmp(name, "prbs7") == 0) {
+        b->order = 7;
+        b->tap = 6;
+    } else if (strcmp(name, "prbs15") == 0) {
+        b->order = 15;
+        b->tap = 14;
+    } else if (strcmp(name, "prbs23") == 0) {
+        b->order = 23;
+        b->tap = 18;
+    } else if (strcmp(name, "off") == 0) {
+        b->order = 0;
+        b->tap = 0;
+    } else {
+        return -EINVAL;
+    }
+    
+    b->reg = b->order ? GENMASK(b->order - 1, 0) : 0;
+    return 0;
+}
+
+static inline u32 uart_bert_next(const struct uart_bert *b)
+{
+    return ((b->reg >> (b->order - 1)) ^ (b->reg >> (b->tap - 1))) & 1;
+}
+
+static inline void uart_bert_shift(struct uart_bert *b, u32 bit)
+{
+    b->reg = ((b->reg << 1) | bit) & GENMASK(b->order - 1, 0);
+}
+
+static inline u32 uart_bert_char_bits(void)
+{
+    return config.data_bits == DATA_BITS_8 ? 8 : 7;
+}
+
+// Fill the given TX FIFO space with the next PRBS characters
+static size_t uart_bert_tx(unsigned int space)
+{
+    u32 bits = uart_bert_char_bits();
+    size_t sent = 0;
+    u32 i, bit;
+    u8 c;
+    
+    while (space--) {
+        c = 0;
+        for (i = 0; i < bits; i++) {
+            bit = uart_bert_next(&bert_gen);
+            uart_bert_shift(&bert_gen, bit);
+            c |= bit << i;
+        }
+        writel(c, &uart->MU_IO);
+        sent++;
+    }
+    
+    stats.bert_tx_bytes += sent;
+    return sent;
+}
+
+static void uart_bert_rx(const u8 *data, size_t len)
+{
+    u32 bits = uart_bert_char_bits();
+    u32 i, bit, expect;
+    bool bad;
+    size_t n;
+    
+    spin_lock(&uart_bert_lock);
+    for (n = 0; n < len && bert_chk.order; n++) {
+        bad = false;
+        for (i = 0; i < bits; i++) {
+            bit = (data[n] >> i) & 1;
+            expect = uart_bert_next(&bert_chk);
+            
+            if (!bert_locked) {
+                bert_good = (expect == bit) ? bert_good + 1 : 0;
+                uart_bert_shift(&bert_chk, bit);
+                if (bert_good >= 2 * bert_chk.order) {
+                    bert_locked = true;
+                    bert_win_bits = 0;
+                    bert_win_errs = 0;
+                }
+                continue;
+            }
+            
+            uart_bert_shift(&bert_chk, expect);
+            stats.bert_rx_bits++;
+            if (expect != bit) {
+                stats.bert_bit_errors++;
+                bert_win_errs++;
+                bad = true;
+            }
+            
+            if (++bert_win_bits == UART_BERT_WINDOW) {
+                if (bert_win_errs > UART_BERT_WINDOW_BAD) {
+                    stats.bert_resyncs++;
+                    bert_locked = false;
+                    bert_good = 0;
+                }
+                bert_win_bits = 0;
+                bert_win_errs = 0;
+            }
+        }
+        if (bad) {
+            stats.bert_byte_errors++;
+        }
+    }
+    spin_unlock(&uart_bert_lock);
+}
+
+// Install a generator polynomial and restart the TX count
+static void uart_bert_set_tx(const struct uart_bert *b)
+{
+    mutex_lock(&uart_tx_mutex);
+    bert_gen = *b;
+    bert_tx_start_ns = local_clock();
+    stats.bert_tx_bytes = 0;
+    mutex_unlock(&uart_tx_mutex);
+}
+
+// Install a checker polynomial and start hunting for lock
+static void uart_bert_set_rx(const struct uart_bert *b)
+{
+    spin_lock(&uart_bert_lock);
+    bert_chk = *b;
+    bert_locked = false;
+    bert_good = 0;
+    bert_rx_start_ns = local_clock();
+    stats.bert_rx_bits = 0;
+    stats.bert_bit_errors = 0;
+    stats.bert_byte_errors = 0;
+    stats.bert_resyncs = 0;
+    spin_unlock(&uart_bert_lock);
+}
+
+// Format errors/bits as "m.mmE-e"
+static int uart_bert_show_ber(char *buf, size_t size, u64 errors, u64 bits)
+{
+    u64 num = errors;
+    u32 e = 0;
+    
+    if (!bits) {
+        return scnprintf(buf, size, "n/a");
+    }
+    if (!errors) {
+        return scnprintf(buf, size, "0 (< 1/%llu)", bits);
+    }
+    
+    while (num < bits && e < 18) {
+        num *= 10;
+        e++;
+    }
+    num = div64_u64(num * 100, bits);
+    return scnprintf(buf, size, "%llu.%02lluE-%u", num / 100, num % 100, e);
+}
+
+// Hand one drained RX burst to the active RX mode
+static void uart_rx_dispatch(const u8 *data, size_t len)
+{
+    if (echo_mode) {
+        uart_echo_rx(data, len);
+        rx_overrun_pending = false;
+        return;
+    }
+    if (READ_ONCE(bert_chk.order)) {
+        uart_bert_rx(data, len);
+        rx_overrun_pending = false;
+        return;
+    }
+    
+    // Auto-responses match the raw stream, so not in the framed modes
+    if (uart_ar_active && !compress_mode && !rcu_access_pointer(uart_net_dev)) {
+        uart_ar_rx(data, len);
+    }
+    
+    if (rcu_access_pointer(uart_net_dev)) {
+        uart_net_rx(data, len);
+        rx_overrun_pending = false;
+    } else if (compress_mode) {
+        uart_comp_rx(data, len);
+    } else if (addr_filter_mode) {
+        uart_addr_rx(data, len);
+    } else {
+        uart_rx_deliver(data, len);
+    }
+}
+
+// Dispatch a drained burst, split where the FIFO overran so that the loss
+// is marked on the first byte delivered after it, which may be in the
+// next burst. Framed modes carry the mark to the start of the next frame
+// they deliver.
+static void uart_rx_dispatch_burst(const u8 *data, size_t len)
+{
+    size_t at = rx_overrun_at;
+    
+    if (at <= len) {
+        if (at) {
+            uart_rx_dispatch(data, at);
+        }
+        rx_overrun_pending = true;
+        data += at;
+        len -= at;
+    }
+    
+    if (len) {
+        uart_rx_dispatch(data, len);
+    }
+}
+
+// Hand the active RX mode a pass with no new data, for gap detection
+static void uart_rx_idle(void)
+{
+    if (addr_filter_mode) {
+        uart_addr_idle();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Periodic TX offload (UART_IOC_PERIODIC_* on /proc/uart_tx)
+//
+// An hrtimer marks a frame due and wakes the service thread, which sends
+// the optional break and then the whole frame before any other TX. The
+// timer only flags work, so a frame still going out when the next period
+// fires is counted as missed rather than queued up. Updates swap in a new
+// frame under periodic_lock; the service thread copies it at frame start,
+// so a frame on the wire is always entirely old or entirely new.
+// ---------------------------------------------------------------------------
+
+#define UART_PERIODIC_MIN_US     100
+#define UART_PERIODIC_BREAK_MAX  10000  // us
+#define UART_PERIODIC_MAB_MAX    1000   // us
+
+static DEFINE_MUTEX(periodic_mutex);  // start/update/stop
+static DEFINE_SPINLOCK(periodic_lock);
+static struct hrtimer periodic_timer;
+static bool periodic_active;
+
+// Latest frame and timing, under periodic_lock
+static u8 periodic_buf[UART_PERIODIC_MAX];
+static u32 periodic_len;
+static u32 periodic_break_us;
+static u32 periodic_mab_us;
+static ktime_t periodic_period;
+static bool periodic_pending;
+static u64 periodic_due_ns;
+
+// Frame on the wire, owned by the service thread
+static u8 periodic_tx[UART_PERIODIC_MAX];
+static u32 periodic_tx_len;
+static u32 periodic_tx_pos;
+
+static struct uart_periodic_stats periodic_stats;
+static u64 periodic_jitter_sum;
+
+static enum hrtimer_restart uart_periodic_fire(struct hrtimer *timer)
+{
+    unsigned long flags;
+    
+    spin_lock_irqsave(&periodic_lock, flags);
+    if (periodic_pending || periodic_tx_len) {
+        periodic_stats.missed++;
+    } else {
+        periodic_pending = true;
+        periodic_due_ns = ktime_to_ns(hrtimer_get_expires(timer));
+    }
+    hrtimer_forward_now(timer, periodic_period);
+    spin_unlock_irqrestore(&periodic_lock, flags);
+    
+    // A running job holds a service reference, so the thread exists
+    uart_svc_kick();
+    return HRTIMER_RESTART;
+}
+
+// Hold the line in break for break_us, then mark for mab_us. Waits for the
+// transmitter to go idle first so no character is cut short. Both times
+// are minimums, so they sleep rather than spin under uart_tx_mutex.
+static void uart_send_break(u32 break_us, u32 mab_us)
+{
+    u32 spins = (u32)div_u64(uart_char_time_ns() * (UART_FIFO_DEPTH + 1),
+                             NSEC_PER_USEC) + 1;
+    u32 lcr;
+    
+    while (!(readl(&uart->MU_LSR) & (1 << 6)) && spins--) {
+        udelay(1);
+    }
+    
+    lcr = readl(&uart->MU_LCR);
+    writel(lcr | (1 << 6), &uart->MU_LCR);
+    fsleep(break_us);
+    writel(lcr, &uart->MU_LCR);
+    fsleep(mab_us);
+}
+
+// Start a due frame and feed it into the TX FIFO. Returns true while a
+// frame is in progress, in which case nothing else may transmit.
+static bool uart_periodic_tx(unsigned int *space, size_t *sent)
+{
+    u32 break_us, mab_us, start;
+    u64 due_ns;
+    s64 jitter;
+    
+    if (!periodic_tx_len) {
+        spin_lock_irq(&periodic_lock);
+        if (!periodic_pending) {
+            spin_unlock_irq(&periodic_lock);
+            return false;
+        }
+        periodic_pending = false;
+        due_ns = periodic_due_ns;
+        memcpy(periodic_tx, periodic_buf, periodic_len);
+        periodic_tx_len = periodic_len;
+        break_us = periodic_break_us;
+        mab_us = periodic_mab_us;
+        spin_unlock_irq(&periodic_lock);
+        
+        jitter = (s64)(ktime_get_ns() - due_ns);
+        if (!periodic_stats.frames || jitter < periodic_stats.jitter_min_ns) {
+            periodic_stats.jitter_min_ns = jitter;
+        }
+        if (!periodic_stats.frames || jitter > periodic_stats.jitter_max_ns) {
+            periodic_stats.jitter_max_ns = jitter;
+        }
+        periodic_jitter_sum += abs(jitter);
+        periodic_tx_pos = 0;
+        
+        if (break_us) {
+            uart_send_break(break_us, mab_us);
+            *space = uart_tx_fifo_space();
+        }
+    }
+    
+    start = periodic_tx_pos;
+    while (*space && periodic_tx_pos < periodic_tx_len) {
+        writel(periodic_tx[periodic_tx_pos], &uart->MU_IO);
+        uart_cap_byte(UART_CAP_TX, periodic_tx[periodic_tx_pos++]);
+        (*space)--;
+        (*sent)++;
+    }
+    uart_flight_log(UART_CAP_TX, periodic_tx + start, periodic_tx_pos - start);
+    
+    if (periodic_tx_pos < periodic_tx_len) {
+        return true;
+    }
+    
+    spin_lock_irq(&periodic_lock);
+    periodic_tx_len = 0;
+    periodic_stats.frames++;
+    spin_unlock_irq(&periodic_lock);
+    return false;
+}
+
+// Whether the last TX pass left a frame part-sent, and when the FIFO it
+// filled runs dry. Service thread only.
+static bool uart_tx_frame_open;
+static u64 uart_tx_dry_ns;
+
+// Push queued client writes into the TX FIFO without waiting. Skipped while
+// a /proc/uart_tx writer owns the transmitter.
+static size_t uart_tx_service(void)
+{
+    struct uart_tx_req *req;
+    u64 now, char_ns;
+    unsigned int space;
+    size_t sent = 0;
+    size_t start, n;
+    bool open = true;
+    
+    if (!mutex_trylock(&uart_tx_mutex)) {
+        return 0;
+    }
+    
+    now = local_clock();
+    char_ns = uart_char_time_ns();
+    space = uart_tx_fifo_space();
+    
+    // Mid-frame, the line has gone idle if the FIFO ran dry too long ago
+    if (uart_tx_frame_open && now > uart_tx_dry_ns + char_ns * 3 / 2) {
+        stats.tx_gaps++;
+    }
+    
+    // A periodic frame goes out back to back, ahead of everything else
+    if (uart_periodic_tx(&space, &sent)) {
+        goto out;
+    }
+    if (uart_ar_tx_service(&space, &sent)) {
+        goto out;
+    }
+    
+    n = uart_echo_tx(space);
+    space -= n;
+    sent += n;
+    
+    open = false;
+    while (space) {
+        spin_lock(&uart_txq_lock);
+        req = list_first_entry_or_null(&uart_txq, struct uart_tx_req, node);
+        spin_unlock(&uart_txq_lock);
+        if (!req) {
+            break;
+        }
+        
+        start = req->pos;
+        while (space && req->pos < req->len) {
+            writel(req->data[req->pos], &uart->MU_IO);
+            uart_cap_byte(UART_CAP_TX, req->data[req->pos++]);
+            space--;
+            sent++;
+        }
+        uart_flight_log(UART_CAP_TX, req->data + start, req->pos - start);
+        
+        if (req->pos < req->len) {
+            open = true;
+            break;
+        }
+        
+        spin_lock(&uart_txq_lock);
+        list_del(&req->node);
+        spin_unlock(&uart_txq_lock);
+        if (req->done) {
+            req->done(req->client, req->ctx, 0);
+        }
+        kfree(req);
+    }
+    
+    if (space && rcu_access_pointer(uart_net_dev)) {
+        sent += uart_net_tx(space);
+    } else if (space && bert_gen.order) {
+        // The PRBS stream only gets what everything else left over
+        n = uart_bert_tx(space);
+        space -= n;
+        sent += n;
+    }
+    
+out:
+    uart_tx_frame_open = open;
+    uart_tx_dry_ns = now + (UART_FIFO_DEPTH - space) * char_ns;
+    stats.tx_bytes += sent;
+    mutex_unlock(&uart_tx_mutex);
+    return sent;
+}
+
+// Fail every queued client write with the given status. Called with
+// uart_tx_mutex held so the service thread is not mid-request.
+static void uart_txq_flush(int status)
+{
+    struct uart_tx_req *req, *tmp;
+    LIST_HEAD(pending);
+    
+    spin_lock(&uart_txq_lock);
+    list_splice_init(&uart_txq, &pending);
+    spin_unlock(&uart_txq_lock);
+    
+    list_for_each_entry_safe(req, tmp, &pending, node) {
+        list_del(&req->node);
+        if (req->done) {
+            req->done(req->client, req->ctx, status);
+        }
+        kfree(req);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Kernel console
+//
+// console->write can run in atomic context on any CPU, so it never sleeps
+// and only appends to its CPU's ring. The rings reach the TX FIFO under
+// uart_tx_mutex, between frames, so console text never lands inside a
+// framed or corked write: the service thread drains them on each pass
+// while it runs, otherwise a work item does. A writer in task context
+// drains directly if the TX mutex is free, and an oops drains regardless.
+// One CPU at a time is the drainer, with a bounded busy-wait per byte.
+// ---------------------------------------------------------------------------
+
+#define UART_CON_RING_SIZE 1024  // power of two
+
+struct uart_con_ring {
+    unsigned int head;  // advanced by the owning CPU
+    unsigned int tail;  // advanced by the drainer
+    char buf[UART_CON_RING_SIZE];
+};
+
+static bool console_enable;
+module_param_named(console, console_enable, bool, 0444);
+MODULE_PARM_DESC(console, "Register the mini UART as a kernel console");
+
+static DEFINE_PER_CPU(struct uart_con_ring, uart_con_rings);
+static atomic_t uart_con_draining = ATOMIC_INIT(0);
+static atomic64_t uart_con_bytes;   // written from every CPU
+static atomic64_t uart_con_drops;
+
+// Busy-wait for TX FIFO space, bounded to a couple of character times
+static bool uart_con_wait_tx(void)
+{
+    u32 spins = (u32)div_u64(uart_char_time_ns() * 2, NSEC_PER_USEC) + 1;
+    
+    while (!(readl(&uart->MU_LSR) & (1 << 5))) {
+        if (spins-- == 0) {
+            return false;
+        }
+        udelay(1);
+    }
+    
+    return true;
+}
+
+// Does any CPU's ring hold text?
+static bool uart_con_pending(void)
+{
+    struct uart_con_ring *ring;
+    int cpu;
+    
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&uart_con_rings, cpu);
+        if (smp_load_acquire(&ring->head) != READ_ONCE(ring->tail)) {
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// Push every ring into the TX FIFO; false if the FIFO stopped draining
+static bool uart_con_drain_rings(void)
+{
+    struct uart_con_ring *ring;
+    unsigned int head, tail;
+    bool stalled = false;
+    int cpu;
+    
+    for_each_possible_cpu(cpu) {
+        ring = per_cpu_ptr(&uart_con_rings, cpu);
+        head = smp_load_acquire(&ring->head);
+        tail = ring->tail;
+        
+        while (tail != head) {
+            if (!uart_con_wait_tx()) {
+                stalled = true;
+                break;
+            }
+            writel((u8)ring->buf[tail % UART_CON_RING_SIZE], &uart->MU_IO);
+            tail++;
+            atomic64_inc(&uart_con_bytes);
+        }
+        
+        smp_store_release(&ring->tail, tail);
+        if (stalled) {
+            break;
+        }
+    }
+    
+    return !stalled;
+}
+
+// Drain the rings if nobody else is doing it. Caller holds uart_tx_mutex,
+// or an oops is in progress.
+static void uart_console_flush(void)
+{
+    bool drained;
+    
+    do {
+        // A CPU that died mid-drain must not silence an oops
+        if (atomic_cmpxchg(&uart_con_draining, 0, 1) != 0 && !oops_in_progress) {
+            return;
+        }
+        drained = uart_con_drain_rings();
+        atomic_set(&uart_con_draining, 0);
+        
+        // A CPU that found us draining left its text to us; pairs with
+        // the barrier implied by its cmpxchg
+        smp_mb();
+    } while (drained && uart_con_pending());
+}
+
+// Drain between frames only; caller holds uart_tx_mutex
+static void uart_console_flush_locked(void)
+{
+    if (!uart_tx_frame_open) {
+        uart_console_flush();
+    }
+}
+
+// Deferred drain for when the service thread is not running
+static void uart_con_work_fn(struct work_struct *work)
+{
+    mutex_lock(&uart_svc_mutex);
+    if (uart_svc_users) {
+        uart_svc_kick();
+        mutex_unlock(&uart_svc_mutex);
+        return;
+    }
+    mutex_unlock(&uart_svc_mutex);
+    
+    // If the thread started meanwhile, the mutex still keeps us between
+    // its frames
+    mutex_lock(&uart_tx_mutex);
+    uart_console_flush_locked();
+    mutex_unlock(&uart_tx_mutex);
+}
+
+static DECLARE_WORK(uart_con_work, uart_con_work_fn);
+
+static void uart_console_write(struct console *con, const char *s,
+                               unsigned int n)
+{
+    struct uart_con_ring *ring;
+    unsigned int head, tail, i, need;
+    unsigned long flags;
+    
+    local_irq_save(flags);
+    ring = this_cpu_ptr(&uart_con_rings);
+    head = ring->head;
+    tail = smp_load_acquire(&ring->tail);
+    
+    for (i = 0; i < n; i++) {
+        need = (s[i] == '\n') ? 2 : 1;
+        if (head - tail + need > UART_CON_RING_SIZE) {
+            atomic64_add(n - i, &uart_con_drops);
+            break;
+        }
+        if (s[i] == '\n') {
+            ring->buf[head++ % UART_CON_RING_SIZE] = '\r';
+        }
+        ring->buf[head++ % UART_CON_RING_SIZE] = s[i];
+    }
+    
+    smp_store_release(&ring->head, head);
+    local_irq_restore(flags);
+    
+    if (unlikely(oops_in_progress)) {
+        uart_console_flush();
+        return;
+    }
+    
+    // Nobody else on the transmitter: write now rather than after a
+    // context switch
+    if (in_task() && !READ_ONCE(uart_svc_users) && mutex_trylock(&uart_tx_mutex)) {
+        if (!READ_ONCE(uart_svc_users)) {
+            uart_console_flush_locked();
+        }
+        mutex_unlock(&uart_tx_mutex);
+        if (!uart_con_pending()) {
+            return;
+        }
+    }
+    
+    schedule_work(&uart_con_work);
+}
+
+static struct console uart_console = {
+    .name  = "ttyMU",
+    .write = uart_console_write,
+    .flags = CON_ENABLED | CON_PRINTBUFFER,
+    .index = -1,
+};
+
+// Longest service sleep, in character times, once the line has gone
+// quiet (svc_idle_chars=). The default keeps the half-FIFO poll; larger
+// values save wakeups on links where the peer only speaks when spoken to,
+// at the risk of overrunning the RX FIFO on unsolicited input.
+static u32 svc_idle_chars = UART_FIFO_DEPTH / 2;
+
+// Sleep for about interval_us, or until uart_svc_kick(). A kick that
+// lands while the pass is still running skips the sleep altogether.
+static void uart_svc_sleep(unsigned long interval_us)
+{
+    ktime_t expires = us_to_ktime(interval_us);
+    u64 t0 = local_clock();
+    
+    set_current_state(TASK_INTERRUPTIBLE);
+    if (!READ_ONCE(uart_svc_kicked) && !kthread_should_stop()) {
+        schedule_hrtimeout_range(&expires, (u64)interval_us * NSEC_PER_USEC / 2,
+                                 HRTIMER_MODE_REL);
+    }
+    __set_current_state(TASK_RUNNING);
+    cost.svc_sleep_ns += local_clock() - t0;
+}
+
+static int uart_service_fn(void *data)
+{
+    u8 burst[UART_RX_BURST];
+    unsigned long interval;
+    u32 chars = UART_FIFO_DEPTH / 2;
+    size_t n;
+    u64 t0;
+    
+    while (!kthread_should_stop()) {
+        t0 = local_clock();
+        cost.svc_wakeups++;
+        WRITE_ONCE(uart_svc_kicked, false);
+        
+        n = uart_rx_drain(burst, sizeof(burst));
+        if (n) {
+            uart_rx_dispatch_burst(burst, n);
+        } else {
+            uart_rx_idle();
+        }
+        n += uart_tx_service();
+        if (console_enable) {
+            mutex_lock(&uart_tx_mutex);
+            uart_console_flush_locked();
+            mutex_unlock(&uart_tx_mutex);
+        }
+        cost.svc_bytes += n;
+        
+        // Sleep for about half a FIFO worth of characters, backing off
+        // while idle. New TX work wakes the thread early.
+        if (n || uart_tx_frame_open) {
+            chars = UART_FIFO_DEPTH / 2;
+        } else {
+            cost.svc_idle_wakeups++;
+            chars = min_t(u32, chars * 2, READ_ONCE(svc_idle_chars));
+        }
+        
+        // Frame gaps are only visible between passes
+        if (addr_filter_mode) {
+            chars = min_t(u32, chars, addr_gap_chars / 2);
+        }
+        interval = max_t(unsigned long, 50,
+                         div_u64(uart_char_time_ns() * chars, NSEC_PER_USEC));
+        
+        // Top up twice as often while a frame must go out gap-free
+        if (uart_tx_frame_open) {
+            interval = max_t(unsigned long, 50, interval / 2);
+        }
+        uart_svc_sleep(interval);
+        
+        cost.svc_time_ns += local_clock() - t0;
+    }
+    
+    return 0;
+}
+
+// Take a reference on the service thread, starting it on first use.
+// Fails with -EBUSY while something else reads the RX FIFO directly.
+static int uart_service_get(void)
+{
+    int ret = 0;
+    
+    mutex_lock(&uart_svc_mutex);
+    if (uart_rx_owners) {
+        ret = -EBUSY;
+    } else if (uart_svc_users == 0) {
+        uart_svc_thread = kthread_run(uart_service_fn, NULL, "rpi2_uart_svc");
+        if (IS_ERR(uart_svc_thread)) {
+            ret = PTR_ERR(uart_svc_thread);
+            uart_svc_thread = NULL;
+            pr_err("Failed to start UART service thread\n");
+        }
+    }
+    if (ret == 0) {
+        uart_svc_users++;
+    }
+    mutex_unlock(&uart_svc_mutex);
+    
+    return ret;
+}
+
+// Drop a service thread reference, stopping it with the last one
+static void uart_service_put(void)
+{
+    mutex_lock(&uart_svc_mutex);
+    if (--uart_svc_users == 0) {
+        kthread_stop(uart_svc_thread);
+        uart_svc_thread = NULL;
+        
+        // Console text the thread did not get to
+        if (console_enable && uart_con_pending()) {
+            schedule_work(&uart_con_work);
+        }
+    }
+    mutex_unlock(&uart_svc_mutex);
+}
+
+// Claim the RX FIFO for direct reads, keeping the service thread from
+// starting until uart_rx_fifo_unclaim(). Fails with -EBUSY if it runs.
+static int uart_rx_fifo_claim(void)
+{
+    int ret = 0;
+    
+    mutex_lock(&uart_svc_mutex);
+    if (uart_svc_users) {
+        ret = -EBUSY;
+    } else {
+        uart_rx_owners++;
+    }
+    mutex_unlock(&uart_svc_mutex);
+    
+    return ret;
+}
+
+static void uart_rx_fifo_unclaim(void)
+{
+    mutex_lock(&uart_svc_mutex);
+    uart_rx_owners--;
+    mutex_unlock(&uart_svc_mutex);
+}
+
+// Switch /proc/uart_rx between direct polling and the service buffer
+static int uart_set_rx_service_mode(bool enable)
+{
+    int ret = 0;
+    
+    // Serialise against a polled reader that is still using the FIFO
+    mutex_lock(&uart_rx_mutex);
+    
+    if (enable && !rx_service_mode) {
+        ret = uart_service_get();
+        if (ret == 0) {
+            rx_service_mode = true;
+        }
+    } else if (!enable && rx_service_mode) {
+        rx_service_mode = false;
+        uart_service_put();
+        wake_up_interruptible(&uart_rx_wait);
+        uart_rx_wake_all();
+    }
+    
+    mutex_unlock(&uart_rx_mutex);
+    return ret;
+}
+
+// Enable or disable compression; decoding needs the service path
+static int uart_set_compress_mode(bool enable)
+{
+    int ret;
+    
+    if (enable) {
+        ret = uart_set_rx_service_mode(true);
+        if (ret) {
+            return ret;
+        }
+        // Bytes left from an earlier session would corrupt the first frame
+        if (!compress_mode) {
+            uart_slip_rx_reset(&comp_rx);
+        }
+    }
+    
+    compress_mode = enable;
+    return 0;
+}
+
+// Register or remove the SLIP network interface; caller holds
+// uart_net_mutex
+static int uart_set_net_mode_locked(bool enable)
+{
+    struct net_device *dev = rcu_dereference_protected(uart_net_dev,
+                                 lockdep_is_held(&uart_net_mutex));
+    int ret;
+    
+    if (enable == !!dev) {
+        return 0;
+    }
+    
+    // Detach from the service path before the device goes away
+    if (!enable) {
+        RCU_INIT_POINTER(uart_net_dev, NULL);
+        synchronize_rcu();
+        unregister_netdev(dev);
+        uart_service_put();
+        netif_napi_del(&uart_napi);
+        free_netdev(dev);
+        net_tx_len = 0;
+        return 0;
+    }
+    
+    dev = alloc_netdev(0, "slmu%d", NET_NAME_ENUM, uart_net_setup);
+    if (!dev) {
+        return -ENOMEM;
+    }
+    
+    skb_queue_head_init(&uart_net_rxq);
+    skb_queue_head_init(&uart_net_txq);
+    netif_napi_add_weight(dev, &uart_napi, uart_net_poll, UART_NET_WEIGHT);
+    
+    ret = register_netdev(dev);
+    if (ret) {
+        netif_napi_del(&uart_napi);
+        free_netdev(dev);
+        return ret;
+    }
+    
+    ret = uart_service_get();
+    if (ret) {
+        unregister_netdev(dev);
+        netif_napi_del(&uart_napi);
+        free_netdev(dev);
+        return ret;
+    }
+    
+    rcu_assign_pointer(uart_net_dev, dev);
+    pr_info("UART network interface %s registered\n", dev->name);
+    return 0;
+}
+
+// Register or remove the SLIP network interface; it runs on the service path
+static int uart_set_net_mode(bool enable)
+{
+    int ret;
+    
+    mutex_lock(&uart_net_mutex);
+    ret = uart_set_net_mode_locked(enable);
+    mutex_unlock(&uart_net_mutex);
+    
+    return ret;
+}
+
+// ---------------------------------------------------------------------------
+// In-kernel client API
+// ---------------------------------------------------------------------------
+
+int rpi2_uart_open(struct rpi2_uart_client *client)
+{
+    int ret;
+    
+    if (!client) {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&uart_client_mutex);
+    if (uart_client) {
+        mutex_unlock(&uart_client_mutex);
+        return -EBUSY;
+    }
+    down_write(&uart_client_sem);
+    uart_client = client;
+    up_write(&uart_client_sem);
+    mutex_unlock(&uart_client_mutex);
+    
+    ret = uart_service_get();
+    if (ret) {
+        mutex_lock(&uart_client_mutex);
+        down_write(&uart_client_sem);
+        uart_client = NULL;
+        up_write(&uart_client_sem);
+        mutex_unlock(&uart_client_mutex);
+        return ret;
+    }
+    
+    pr_info("UART client attached\n");
+    return 0;
+}
+EXPORT_SYMBOL_GPL(rpi2_uart_open);
+
+void rpi2_uart_close(struct rpi2_uart_client *client)
+{
+    // RX dispatch holds uart_client_mutex, so no callback runs after this
+    mutex_lock(&uart_client_mutex);
+    if (uart_client != client) {
+        mutex_unlock(&uart_client_mutex);
+        return;
+    }
+    // Waits out any write or setter still acting for this client, so
+    // nothing can be queued behind the flush below
+    down_write(&uart_client_sem);
+    uart_client = NULL;
+    up_write(&uart_client_sem);
+    mutex_unlock(&uart_client_mutex);
+    
+    mutex_lock(&uart_tx_mutex);
+    uart_txq_flush(-ECANCELED);
+    mutex_unlock(&uart_tx_mutex);
+    
+    uart_service_put();
+    
+    pr_info("UART client detached\n");
+}
+EXPORT_SYMBOL_GPL(rpi2_uart_close);
+
+int rpi2_uart_write(struct rpi2_uart_client *client, const u8 *data,
+                    size_t len, rpi2_uart_tx_done_cb done, void *ctx)
+{
+    struct uart_tx_req *req;
+    size_t chunks, off, n;
+    int ret = 0;
+    
+    if (!len) {
+        return -EINVAL;
+    }
+    
+    down_read(&uart_client_sem);
+    if (client != uart_client) {
+        ret = -EINVAL;
+        goto out;
+    }
+    
+    // With compress=lz4 the peer expects frames from the client too, so
+    // the request carries them already encoded
+    chunks = compress_mode ? DIV_ROUND_UP(len, UART_COMP_MAX_RAW) : 0;
+    req = kmalloc(sizeof(*req) + (chunks ? chunks * sizeof(comp_tx_wire) : len),
+                  GFP_KERNEL);
+    if (!req) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    
+    req->client = client;
+    req->done = done;
+    req->ctx = ctx;
+    req->pos = 0;
+    if (chunks) {
+        req->len = 0;
+        for (off = 0; off < len; off += n) {
+            n = min_t(size_t, len - off, UART_COMP_MAX_RAW);
+            req->len += uart_comp_encode(data + off, n, req->data + req->len);
+        }
+    } else {
+        req->len = len;
+        memcpy(req->data, data, len);
+    }
+    
+    spin_lock(&uart_txq_lock);
+    list_add_tail(&req->node, &uart_txq);
+    spin_unlock(&uart_txq_lock);
+    uart_svc_kick();
+    
+out:
+    up_read(&uart_client_sem);
+    return ret;
+}
+EXPORT_SYMBOL_GPL(rpi2_uart_write);
+
+int rpi2_uart_set_baudrate(struct rpi2_uart_client *client, u32 baudrate)
+{
+    int ret = -EINVAL;
+    
+    down_read(&uart_client_sem);
+    if (client == uart_client && uart_baud_supported(baudrate)) {
+        config.baudrate = baudrate;
+        ret = uart_apply_config();
+    }
+    up_read(&uart_client_sem);
+    
+    return ret;
+}
+EXPORT_SYMBOL_GPL(rpi2_uart_set_baudrate);
+
+int rpi2_uart_set_data_bits(struct rpi2_uart_client *client, u32 bits)
+{
+    int ret = -EINVAL;
+    
+    down_read(&uart_client_sem);
+    if (client == uart_client && (bits == 7 || bits == 8)) {
+        config.data_bits = (bits == 8) ? DATA_BITS_8 : DATA_BITS_7;
+        ret = uart_apply_config();
+    }
+    up_read(&uart_client_sem);
+    
+    return ret;
+}
+EXPORT_SYMBOL_GPL(rpi2_uart_set_data_bits);
+
+// Fill in the header of the next record for a record-mode reader and
+// return how many data bytes it may carry. The record stops short of the
+// next marked position, so every mark starts a record of its own. Caller
+// holds uart_rx_lock and has checked limit > r->pos.
+static size_t uart_rx_rec_next(struct uart_rx_reader *r, struct uart_rx_rec *rec,
+                               u64 limit, size_t room)
+{
+    u64 first = rx_event_head > UART_RX_EVENTS ? rx_event_head - UART_RX_EVENTS : 0;
+    struct uart_rx_event *ev;
+    
+    memset(rec, 0, sizeof(*rec));
+    rec->pos = r->pos;
+    if (r->lost) {
+        rec->flags |= UART_RX_REC_DROPPED;
+        rec->lost = min_t(u64, r->lost, U32_MAX);
+        r->lost = 0;
+    }
+    
+    // Events inside data this reader dropped are covered by the drop
+    for (r->ev_next = max(r->ev_next, first); r->ev_next < rx_event_head;
+         r->ev_next++) {
+        ev = &rx_events[r->ev_next & (UART_RX_EVENTS - 1)];
+        if (ev->pos > r->pos) {
+            limit = min(limit, ev->pos);
+            break;
+        }
+        if (ev->pos == r->pos) {
+            rec->flags |= ev->flags;
+        }
+    }
+    
+    rec->len = min3(limit - r->pos, (u64)room, (u64)U16_MAX);
+    return rec->len;
+}
+
+// Read from the service path history ring (rx_mode=service). Unlike the
+// polled path this is a stream: it blocks until data arrives. In record
+// mode each read returns a struct uart_rx_rec header and its data.
+static ssize_t uart_proc_read_buffered(struct kiocb *iocb, struct iov_iter *to,
+                                       size_t count)
+{
+    struct file *file = iocb->ki_filp;
+    struct uart_rx_reader *r = file->private_data;
+    wait_queue_head_t *wq;
+    struct uart_rx_rec rec;
+    size_t n, off, first, room, hdr = 0;
+    u64 tail, limit, t0, arrived;
+    u8 *bounce;
+    long ret;
+    
+    if (!r || (r->record && count <= sizeof(rec))) {
+        return -EINVAL;
+    }
+    
+    // Message readers wait on their own queue for a complete message
+    wq = (r->wake.mode == UART_RX_WAKE_ANY) ? &uart_rx_wait : &r->wait;
+    
+    bounce = kmalloc(min_t(size_t, count, UART_RX_READ_MAX), GFP_KERNEL);
+    if (!bounce) {
+        return -ENOMEM;
+    }
+    
+retry:
+    if (uart_rx_readable(r) <= r->pos &&
+        ((file->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))) {
+        kfree(bounce);
+        return -EAGAIN;
+    }
+    
+    t0 = local_clock();
+    ret = wait_event_interruptible(*wq,
+            uart_rx_readable(r) > r->pos || !rx_service_mode);
+    r->acct.block_ns += local_clock() - t0;
+    if (ret < 0) {
+        kfree(bounce);
+        return ret;
+    }
+    
+    spin_lock(&uart_rx_lock);
+    
+    // A reader that fell a whole ring behind loses the overwritten bytes
+    tail = uart_rx_ring_tail();
+    if (r->pos < tail) {
+        stats.rx_buffer_drops += tail - r->pos;
+        r->acct.drops += tail - r->pos;
+        r->lost += tail - r->pos;
+        r->pos = tail;
+    }
+    
+    limit = uart_rx_readable(r);
+    if (limit <= r->pos) {
+        // Only a lost partial message was left; wait for the next one
+        spin_unlock(&uart_rx_lock);
+        if (!rx_service_mode) {
+            kfree(bounce);
+            return 0;
+        }
+        goto retry;
+    }
+    
+    room = min_t(size_t, count, UART_RX_READ_MAX);
+    if (r->record) {
+        hdr = sizeof(rec);
+        n = uart_rx_rec_next(r, &rec, limit, room - hdr);
+        memcpy(bounce, &rec, hdr);
+    } else {
+        n = min_t(u64, limit - r->pos, room);
+    }
+    off = r->pos & (UART_RX_BUF_SIZE - 1);
+    first = min_t(size_t, n, UART_RX_BUF_SIZE - off);
+    memcpy(bounce + hdr, uart_rx_ring + off, first);
+    memcpy(bounce + hdr + first, uart_rx_ring, n - first);
+    arrived = uart_rx_mark_ts(r->pos);
+    r->pos += n;
+    
+    spin_unlock(&uart_rx_lock);
+    
+    if (copy_to_iter(bounce, hdr + n, to) != hdr + n) {
+        stats.rx_errors++;
+        kfree(bounce);
+        return -EFAULT;
+    }
+    
+    if (arrived) {
+        uart_lat_record(UART_LAT_SERVICE, ktime_get_ns() - arrived);
+    }
+    kfree(bounce);
+    r->acct.ops++;
+    r->acct.bytes += n;
+    return hdr + n;
+}
+
+// Each open of /proc/uart_rx gets its own position, starting at "now"
+static int uart_rx_open(struct inode *inode, struct file *file)
+{
+    struct uart_rx_reader *r;
+    
+    r = kzalloc(sizeof(*r), GFP_KERNEL);
+    if (!r) {
+        return -ENOMEM;
+    }
+    
+    init_waitqueue_head(&r->wait);
+    
+    if (uart_io_acct_add(&r->acct, 'R')) {
+        kfree(r);
+        return -ENOMEM;
+    }
+    
+    spin_lock(&uart_rx_lock);
+    r->pos = rx_head;
+    spin_unlock(&uart_rx_lock);
+    
+    file->private_data = r;
+    return 0;
+}
+
+static int uart_rx_release(struct inode *inode, struct file *file)
+{
+    struct uart_rx_reader *r = file->private_data;
+    
+    if (r->wake.mode != UART_RX_WAKE_ANY) {
+        spin_lock(&uart_rx_lock);
+        list_del(&r->node);
+        spin_unlock(&uart_rx_lock);
+    }
+    uart_io_acct_del(&r->acct);
+    kfree(r);
+    return 0;
+}
+
+// Move a reader to the oldest retained byte, to now, or to a timestamp
+static long uart_rx_seek(struct file *file, void __user *argp)
+{
+    struct uart_rx_reader *r = file->private_data;
+    struct uart_rx_seek req;
+    u64 start;
+    
+    if (copy_from_user(&req, argp, sizeof(req))) {
+        return -EFAULT;
+    }
+    
+    spin_lock(&uart_rx_lock);
+    start = uart_rx_history_start();
+    switch (req.whence) {
+    case UART_RX_SEEK_OLDEST:
+        r->pos = start;
+        break;
+    case UART_RX_SEEK_NOW:
+        r->pos = rx_head;
+        break;
+    case UART_RX_SEEK_TIME:
+        r->pos = max(start, uart_rx_ring_find(req.ts_ns));
+        break;
+    default:
+        spin_unlock(&uart_rx_lock);
+        return -EINVAL;
+    }
+    if (r->wake.mode != UART_RX_WAKE_ANY) {
+        uart_rx_wake_reset(r, r->pos);
+    }
+    r->ev_next = uart_rx_event_find(r->pos);
+    r->lost = 0;
+    req.pos = r->pos;
+    req.available = rx_head - r->pos;
+    spin_unlock(&uart_rx_lock);
+    
+    if (copy_to_user(argp, &req, sizeof(req))) {
+        return -EFAULT;
+    }
+    
+    return 0;
+}
+
+// Set or clear this file's message wakeup condition. Tracking starts at
+// the file's current position.
+static long uart_rx_set_wake(struct file *file, void __user *argp)
+{
+    struct uart_rx_reader *r = file->private_data;
+    struct uart_rx_wake w;
+    bool listed;
+    
+    if (copy_from_user(&w, argp, sizeof(w))) {
+        return -EFAULT;
+    }
+    
+    switch (w.mode) {
+    case UART_RX_WAKE_ANY:
+    case UART_RX_WAKE_DELIM:
+        break;
+    case UART_RX_WAKE_LENGTH:
+        if (w.len_size != 1 && w.len_size != 2) {
+            return -EINVAL;
+        }
+        break;
+    case UART_RX_WAKE_FIXED:
+        if (w.frame_size == 0 || w.frame_size > UART_RX_BUF_SIZE) {
+            return -EINVAL;
+        }
+        break;
+    default:
+        return -EINVAL;
+    }
+    
+    spin_lock(&uart_rx_lock);
+    listed = r->wake.mode != UART_RX_WAKE_ANY;
+    r->wake = w;
+    if (w.mode != UART_RX_WAKE_ANY) {
+        if (!listed) {
+            list_add_tail(&r->node, &uart_rx_wake_readers);
+        }
+        // Data already buffered may hold complete messages
+        uart_rx_wake_reset(r, r->pos);
+    } else if (listed) {
+        list_del(&r->node);
+    }
+    spin_unlock(&uart_rx_lock);
+    
+    wake_up_interruptible(&r->wait);
+    return 0;
+}
+
+// Switch this file between plain reads and record mode. Marks are
+// reported from the file's current position on.
+static long uart_rx_set_record(struct file *file, unsigned long arg)
+{
+    struct uart_rx_reader *r = file->private_data;
+    
+    if (arg > 1) {
+        return -EINVAL;
+    }
+    
+    spin_lock(&uart_rx_lock);
+    r->record = arg;
+    r->ev_next = uart_rx_event_find(r->pos);
+    r->lost = 0;
+    spin_unlock(&uart_rx_lock);
+    
+    return 0;
+}
+
+// Replace the RX filter; a NULL program detaches it
+static void uart_rx_filter_set(struct bpf_prog *prog)
+{
+    struct bpf_prog *old;
+    
+    mutex_lock(&uart_filter_mutex);
+    old = rcu_dereference_protected(uart_rx_filter,
+                                    lockdep_is_held(&uart_filter_mutex));
+    rcu_assign_pointer(uart_rx_filter, prog);
+    mutex_unlock(&uart_filter_mutex);
+    
+    if (old) {
+        synchronize_rcu();
+        bpf_prog_destroy(old);
+    }
+}
+
+// Install the filter described by fprog, whose program is in user memory
+static int uart_rx_filter_attach(struct sock_fprog *fprog)
+{
+    struct bpf_prog *prog;
+    int ret;
+    
+    // Scratch packet the filter runs against, reused for every burst
+    mutex_lock(&uart_filter_mutex);
+    if (!uart_filter_skb) {
+        uart_filter_skb = alloc_skb(UART_FILTER_MAX_LEN, GFP_KERNEL);
+    }
+    mutex_unlock(&uart_filter_mutex);
+    if (!uart_filter_skb) {
+        return -ENOMEM;
+    }
+    
+    ret = bpf_prog_create_from_user(&prog, fprog, NULL, false);
+    if (ret) {
+        return ret;
+    }
+    
+    uart_rx_filter_set(prog);
+    pr_info("UART RX filter attached (%u insns)\n", fprog->len);
+    return 0;
+}
+
+// ioctl handler on /proc/uart_rx
+static long uart_rx_ioctl(struct file *file, unsigned int cmd,
+                          unsigned long arg)
+{
+    struct sock_fprog fprog;
+    
+    switch (cmd) {
+    case UART_IOC_ATTACH_FILTER:
+        // The filter decides for every reader and the kernel client
+        if (!capable(CAP_NET_ADMIN)) {
+            return -EPERM;
+        }
+        if (copy_from_user(&fprog, (void __user *)arg, sizeof(fprog))) {
+            return -EFAULT;
+        }
+        return uart_rx_filter_attach(&fprog);
+    case UART_IOC_DETACH_FILTER:
+        if (!capable(CAP_NET_ADMIN)) {
+            return -EPERM;
+        }
+        uart_rx_filter_set(NULL);
+        return 0;
+    case UART_IOC_RX_SEEK:
+        return uart_rx_seek(file, (void __user *)arg);
+    case UART_IOC_RX_SET_WAKE:
+        return uart_rx_set_wake(file, (void __user *)arg);
+    case UART_IOC_RX_SET_RECORD:
+        return uart_rx_set_record(file, arg);
+    default:
+        return -ENOTTY;
+    }
+}
+
+#ifdef CONFIG_COMPAT
+// struct sock_fprog carries a pointer, so 32-bit callers pass a
+// differently sized struct and with it a different command number
+#define UART_IOC_ATTACH_FILTER32  _IOW(UART_IOC_MAGIC, 16, struct compat_sock_fprog)
+
+// The other RX ioctls have the same layout for 32-bit callers
+static long uart_rx_compat_ioctl(struct file *file, unsigned int cmd,
+                                 unsigned long arg)
+{
+    struct compat_sock_fprog cfprog;
+    struct sock_fprog fprog;
+    
+    if (cmd != UART_IOC_ATTACH_FILTER32) {
+        return compat_ptr_ioctl(file, cmd, arg);
+    }
+    
+    if (!capable(CAP_NET_ADMIN)) {
+        return -EPERM;
+    }
+    if (copy_from_user(&cfprog, compat_ptr(arg), sizeof(cfprog))) {
+        return -EFAULT;
+    }
+    fprog.len = cfprog.len;
+    fprog.filter = compat_ptr(cfprog.filter);
+    
+    return uart_rx_filter_attach(&fprog);
+}
+#else
+#define uart_rx_compat_ioctl NULL
+#endif
+
+// Proc file read handler for receiving data
+// CHANGED: usleep_range instead of udelay - HUGE performance improvement!
+// Implemented as read_iter so readv() and splice()/sendfile() from
+// /proc/uart_rx work without a userspace bounce.
+static ssize_t uart_proc_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct uart_rx_reader *r = iocb->ki_filp->private_data;
+    size_t count = iov_iter_count(to);
+    loff_t *ppos = &iocb->ki_pos;
+    char kbuf[512];
+    int i = 0;
+    char c;
+    int consecutive_no_data = 0;
+    const int MAX_CONSECUTIVE_NO_DATA = 300;
+    u64 t0, tb, first_ns = 0;
+    
+    if (rx_service_mode) {
+        return uart_proc_read_buffered(iocb, to, count);
+    }
+    
+    if (*ppos > 0) {
+        return 0;
+    }
+    
+    tb = local_clock();
+    mutex_lock(&uart_rx_mutex);
+    
+    // The service thread owns the RX FIFO while a client is attached
+    if (uart_rx_fifo_claim()) {
+        mutex_unlock(&uart_rx_mutex);
+        return -EBUSY;
+    }
+    t0 = local_clock();
+    
+    // Wait for first character with timeout
+    // CHANGED: usleep_range instead of udelay(1000)
+    int timeout = 1000;  // 1 second total
+    while (!uart_data_available() && timeout-- > 0) {
+        uart_cost_sleep(1000, 1500, &cost.rx_sleep_ns);  // Sleep 1-1.5ms (was busy-waiting!)
+    }
+    r->acct.block_ns += local_clock() - tb;
+    
+    if (timeout <= 0) {
+        cost.rx_time_ns += local_clock() - t0;
+        uart_rx_fifo_unclaim();
+        mutex_unlock(&uart_rx_mutex);
+        return 0;
+    }
+    
+    // Read all available characters
+    while (i < (sizeof(kbuf) - 1) && i < count) {
+        while (uart_data_available() && i < (sizeof(kbuf) - 1) && i < count) {
+            c = uart_receive_char();
+            if (c != 0) {
+                if (i == 0) {
+                    // c itself has already left the FIFO
+                    first_ns = uart_rx_arrival_ns(
+                        ((readl(&uart->MU_STAT) >> 16) & 0xF) + 1);
+                }
+                kbuf[i++] = c;
+                consecutive_no_data = 0;
+            }
+        }
+        
+        // CHANGED: usleep_range instead of udelay
+        if (i > 0 && !uart_data_available()) {
+            uart_cost_sleep(1000, 1500, &cost.rx_sleep_ns);  // Sleep 1-1.5ms
+            consecutive_no_data++;
+            
+            if (consecutive_no_data >= MAX_CONSECUTIVE_NO_DATA) {
+                break;
+            }
+        } else if (i == 0 && !uart_data_available()) {
+            uart_cost_sleep(1000, 1500, &cost.rx_sleep_ns);  // Sleep 1-1.5ms
+            consecutive_no_data++;
+            if (consecutive_no_data >= MAX_CONSECUTIVE_NO_DATA) {
+                break;
+            }
+        }
+    }
+    
+    cost.rx_time_ns += local_clock() - t0;
+    cost.rx_bytes += i;
+    uart_rx_fifo_unclaim();
+    mutex_unlock(&uart_rx_mutex);
+    
+    if (i == 0) {
+        return 0;
+    }
+    
+    kbuf[i] = '\0';
+    uart_flight_log(UART_CAP_RX, (const u8 *)kbuf, i);
+    
+    if (copy_to_iter(kbuf, i, to) != i) {
+        stats.rx_errors++;
+        return -EFAULT;
+    }
+    
+    uart_lat_record(UART_LAT_POLL, ktime_get_ns() - first_ns);
+    *ppos += i;
+    r->acct.ops++;
+    r->acct.bytes += i;
+    
+    pr_info("UART RX: received %d bytes\n", i);
+    return i;
+}
+
+// ---------------------------------------------------------------------------
+// TX corking (UART_IOC_TX_CORK / UART_IOC_TX_UNCORK on /proc/uart_tx)
+//
+// While corked, writes on a file are only collected. Uncorking queues the
+// collected bytes as one request for the service thread, which keeps the
+// FIFO topped up so the frame goes out without inter-byte gaps, and waits
+// for it to leave. Corked data is sent raw, without newline translation.
+// ---------------------------------------------------------------------------
+
+#define UART_TX_CORK_MAX  4096
+
+struct uart_tx_file {
+    u8 *cork_buf;
+    size_t cork_len;
+    bool corked;
+    bool svc_ref;  // holds a service thread reference
+    struct uart_io_acct acct;
+};
+
+struct uart_tx_wait {
+    struct completion done;
+    int status;
+};
+
+static int uart_tx_open(struct inode *inode, struct file *file)
+{
+    struct uart_tx_file *tf;
+    
+    tf = kzalloc(sizeof(*tf), GFP_KERNEL);
+    if (!tf) {
+        return -ENOMEM;
+    }
+    
+    if (uart_io_acct_add(&tf->acct, 'T')) {
+        kfree(tf);
+        return -ENOMEM;
+    }
+    
+    file->private_data = tf;
+    return 0;
+}
+
+static int uart_tx_release(struct inode *inode, struct file *file)
+{
+    struct uart_tx_file *tf = file->private_data;
+    
+    if (tf->svc_ref) {
+        uart_service_put();
+    }
+    uart_io_acct_del(&tf->acct);
+    kfree(tf->cork_buf);
+    kfree(tf);
+    return 0;
+}
+
+static long uart_tx_cork(struct uart_tx_file *tf)
+{
+    int ret;
+    
+    if (!tf->cork_buf) {
+        tf->cork_buf = kmalloc(UART_TX_CORK_MAX, GFP_KERNEL);
+        if (!tf->cork_buf) {
+            return -ENOMEM;
+        }
+    }
+    
+    // Keep the service thread for the life of the file rather than
+    // restarting it for every frame
+    if (!tf->svc_ref) {
+        ret = uart_service_get();
+        if (ret) {
+            return ret;
+        }
+        tf->svc_ref = true;
+    }
+    
+    tf->corked = true;
+    return 0;
+}
+
+static void uart_tx_uncork_done(struct rpi2_uart_client *client, void *ctx,
+                                int status)
+{
+    struct uart_tx_wait *wait = ctx;
+    
+    wait->status = status;
+    complete(&wait->done);
+}
+
+static long uart_tx_uncork(struct uart_tx_file *tf)
+{
+    struct uart_tx_wait wait;
+    struct uart_tx_req *req;
+    size_t len = tf->cork_len;
+    size_t off, n;
+    u64 t0 = local_clock();
+    
+    if (!tf->corked) {
+        return -EINVAL;
+    }
+    
+    tf->corked = false;
+    tf->cork_len = 0;
+    if (!len) {
+        return 0;
+    }
+    
+    // A compressed frame carries at most UART_COMP_MAX_RAW bytes
+    if (compress_mode) {
+        for (off = 0; off < len; off += n) {
+            n = min_t(size_t, len - off, UART_COMP_MAX_RAW);
+            uart_comp_send(tf->cork_buf + off, n);
+        }
+        uart_io_acct_tx(&tf->acct, len, local_clock() - t0);
+        return 0;
+    }
+    
+    req = kmalloc(struct_size(req, data, len), GFP_KERNEL);
+    if (!req) {
+        return -ENOMEM;
+    }
+    
+    init_completion(&wait.done);
+    req->client = NULL;
+    req->done = uart_tx_uncork_done;
+    req->ctx = &wait;
+    req->len = len;
+    req->pos = 0;
+    memcpy(req->data, tf->cork_buf, len);
+    
+    spin_lock(&uart_txq_lock);
+    list_add_tail(&req->node, &uart_txq);
+    spin_unlock(&uart_txq_lock);
+    uart_svc_kick();
+    
+    // Bounded by the frame time; the request holds a pointer to wait
+    wait_for_completion(&wait.done);
+    uart_io_acct_tx(&tf->acct, len, local_clock() - t0);
+    return wait.status;
+}
+
+// Proc file write handler for transmitting data
+static ssize_t uart_proc_write(struct file *file,
+    const char __user *buf, size_t count, loff_t *ppos)
+{
+    struct uart_tx_file *tf = file->private_data;
+    char kbuf[512];
+    size_t len;
+    u64 t0;
+    
+    if (tf->corked) {
+        if (count > UART_TX_CORK_MAX - tf->cork_len) {
+            return -EMSGSIZE;
+        }
+        if (copy_from_user(tf->cork_buf + tf->cork_len, buf, count)) {
+            stats.tx_errors++;
+            return -EFAULT;
+        }
+        tf->cork_len += count;
+        return count;
+    }
+    
+    len = min(count, sizeof(kbuf) - 1);
+    
+    if (copy_from_user(kbuf, buf, len)) {
+        stats.tx_errors++;
+        return -EFAULT;
+    }
+    
+    kbuf[len] = '\0';
+    
+    t0 = local_clock();
+    if (compress_mode) {
+        uart_comp_send((const u8 *)kbuf, len);
+    } else {
+        uart_send_string(kbuf);
+    }
+    uart_io_acct_tx(&tf->acct, len, local_clock() - t0);
+    
+    pr_info("UART TX: sent %zu bytes\n", len);
+    
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// XMODEM / XMODEM-1K / YMODEM sender (UART_IOC_XFER_SEND)
+//
+// Runs the whole transfer in the ioctl caller's context, reading the file
+// straight from the passed fd. ACK waits are derived from the line rate:
+// the time for the TX FIFO to drain plus a fixed peer turnaround.
+// ---------------------------------------------------------------------------
+
+#define XM_SOH  0x01
+#define XM_STX  0x02
+#define XM_EOT  0x04
+#define XM_ACK  0x06
+#define XM_NAK  0x15
+#define XM_CAN  0x18
+#define XM_CRC  'C'
+#define XM_PAD  0x1A
+
+#define XM_RETRIES        10
+#define XM_START_TIMEOUT  (60 * USEC_PER_SEC)
+#define XM_TURNAROUND_US  USEC_PER_SEC
+
+static struct uart_xfer_status xfer_status;
+
+// Wait up to timeout_us for one received byte
+static int uart_xfer_getc(u64 timeout_us)
+{
+    u64 deadline = local_clock() + timeout_us * NSEC_PER_USEC;
+    unsigned long poll_us = max_t(unsigned long, 100,
+                                  div_u64(uart_char_time_ns(), NSEC_PER_USEC));
+    
+    while (!uart_data_available()) {
+        if (local_clock() >= deadline) {
+            return -ETIMEDOUT;
+        }
+        if (signal_pending(current)) {
+            return -EINTR;
+        }
+        uart_cost_sleep(poll_us, poll_us * 2, &cost.rx_sleep_ns);
+    }
+    
+    return (u8)uart_receive_char();
+}
+
+// Drop stale bytes (line noise, repeated 'C') before sending a block
+static void uart_xfer_purge(void)
+{
+    while (uart_data_available()) {
+        readl(&uart->MU_IO);
+    }
+}
+
+static u64 uart_xfer_ack_timeout_us(void)
+{
+    return div_u64(uart_char_time_ns() * UART_FIFO_DEPTH, NSEC_PER_USEC) +
+           XM_TURNAROUND_US;
+}
+
+// Wait for the receiver's start request; sets *crc for 'C', clears for NAK
+static int uart_xfer_wait_start(bool *crc)
+{
+    u64 deadline = local_clock() + (u64)XM_START_TIMEOUT * NSEC_PER_USEC;
+    int c, prev = 0;
+    
+    while (local_clock() < deadline) {
+        c = uart_xfer_getc(XM_TURNAROUND_US);
+        if (c == -ETIMEDOUT) {
+            continue;
+        }
+        if (c < 0) {
+            return c;
+        }
+        if (c == XM_CRC || c == XM_NAK) {
+            *crc = (c == XM_CRC);
+            return 0;
+        }
+        if (c == XM_CAN && prev == XM_CAN) {
+            return -ECANCELED;
+        }
+        prev = c;
+    }
+    
+    return -ETIMEDOUT;
+}
+
+// Send one block and wait for it to be acknowledged
+static int uart_xfer_send_block(u8 *blk, u8 num, size_t size, bool crc)
+{
+    size_t len = 3 + size;
+    int retry, c;
+    u16 sum;
+    size_t i;
+    
+    blk[0] = (size == 1024) ? XM_STX : XM_SOH;
+    blk[1] = num;
+    blk[2] = ~num;
+    
+    if (crc) {
+        sum = crc_itu_t(0, blk + 3, size);
+        blk[len++] = sum >> 8;
+        blk[len++] = sum & 0xFF;
+    } else {
+        for (sum = 0, i = 0; i < size; i++) {
+            sum += blk[3 + i];
+        }
+        blk[len++] = sum & 0xFF;
+    }
+    
+    for (retry = 0; retry < XM_RETRIES; retry++) {
+        uart_xfer_purge();
+        uart_send_raw_locked(blk, len);
+        
+        c = uart_xfer_getc(uart_xfer_ack_timeout_us());
+        if (c == XM_ACK) {
+            xfer_status.blocks++;
+            return 0;
+        }
+        if (c == XM_CAN && uart_xfer_getc(XM_TURNAROUND_US) == XM_CAN) {
+            return -ECANCELED;
+        }
+        if (c == -EINTR) {
+            return c;
+        }
+        xfer_status.retries++;
+    }
+    
+    return -EIO;
+}
+
+// Finish the data phase with EOT; receivers may NAK the first one
+static int uart_xfer_send_eot(void)
+{
+    u8 eot = XM_EOT;
+    int retry, c;
+    
+    for (retry = 0; retry < XM_RETRIES; retry++) {
+        uart_send_raw_locked(&eot, 1);
+        c = uart_xfer_getc(uart_xfer_ack_timeout_us());
+        if (c == XM_ACK) {
+            return 0;
+        }
+        if (c == -EINTR) {
+            return c;
+        }
+        xfer_status.retries++;
+    }
+    
+    return -EIO;
+}
+
+// Read a whole block, carrying on through short reads from pipes and
+// FIFOs; returns less than len only at end of file
+static ssize_t uart_xfer_read_block(struct file *file, u8 *buf, size_t len,
+                                    loff_t *pos)
+{
+    size_t got = 0;
+    ssize_t n;
+    
+    while (got < len) {
+        n = kernel_read(file, buf + got, len - got, pos);
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            break;
+        }
+        got += n;
+    }
+    
+    return got;
+}
+
+static int uart_xfer_send_file(struct file *file, u32 protocol)
+{
+    size_t bsize = (protocol == UART_XFER_XMODEM) ? 128 : 1024;
+    bool ymodem = (protocol == UART_XFER_YMODEM);
+    loff_t pos = 0;
+    ssize_t n;
+    u8 *blk;
+    u8 num = 1;
+    bool crc;
+    int ret;
+    
+    // header + 1K data + CRC
+    blk = kmalloc(3 + 1024 + 2, GFP_KERNEL);
+    if (!blk) {
+        return -ENOMEM;
+    }
+    
+    xfer_status.state = UART_XFER_WAITING;
+    ret = uart_xfer_wait_start(&crc);
+    if (ret) {
+        goto out;
+    }
+    
+    xfer_status.state = UART_XFER_SENDING;
+    
+    // YMODEM block 0: "name\0size"
+    if (ymodem) {
+        char *hdr = (char *)blk + 3;
+        int nlen;
+        
+        // Leave room for the decimal size after the name
+        memset(hdr, 0, 128);
+        nlen = scnprintf(hdr, 128 - 24, "%pd", file->f_path.dentry);
+        snprintf(hdr + nlen + 1, 128 - nlen - 1, "%llu", xfer_status.total);
+        
+        ret = uart_xfer_send_block(blk, 0, 128, true);
+        if (ret == 0) {
+            ret = uart_xfer_wait_start(&crc);
+        }
+        if (ret) {
+            goto out;
+        }
+    }
+    
+    // Only the last block can be short, so padding never lands mid-file
+    while ((n = uart_xfer_read_block(file, blk + 3, bsize, &pos)) > 0) {
+        size_t size = (n <= 128) ? 128 : bsize;
+        
+        memset(blk + 3 + n, XM_PAD, size - n);
+        ret = uart_xfer_send_block(blk, num++, size, crc);
+        if (ret) {
+            goto out;
+        }
+        xfer_status.bytes += n;
+    }
+    
+    if (n < 0) {
+        ret = n;
+        goto out;
+    }
+    
+    ret = uart_xfer_send_eot();
+    
+    // An empty block 0 ends the YMODEM batch
+    if (ret == 0 && ymodem) {
+        ret = uart_xfer_wait_start(&crc);
+        if (ret == 0) {
+            memset(blk + 3, 0, 128);
+            ret = uart_xfer_send_block(blk, 0, 128, crc);
+        }
+    }
+    
+out:
+    if (ret == -ECANCELED || ret == -EINTR) {
+        u8 can[2] = { XM_CAN, XM_CAN };
+        
+        uart_send_raw_locked(can, sizeof(can));
+    }
+    kfree(blk);
+    return ret;
+}
+
+static long uart_xfer_ioctl_send(void __user *argp)
+{
+    struct uart_xfer_req req;
+    struct file *file;
+    int ret;
+    
+    if (copy_from_user(&req, argp, sizeof(req))) {
+        return -EFAULT;
+    }
+    
+    if (req.protocol > UART_XFER_YMODEM) {
+        return -EINVAL;
+    }
+    
+    file = fget(req.fd);
+    if (!file) {
+        return -EBADF;
+    }
+    
+    // The engine reads the RX FIFO itself, for the whole transfer
+    mutex_lock(&uart_rx_mutex);
+    if (uart_rx_fifo_claim()) {
+        mutex_unlock(&uart_rx_mutex);
+        fput(file);
+        return -EBUSY;
+    }
+    mutex_lock(&uart_tx_mutex);
+    
+    memset(&xfer_status, 0, sizeof(xfer_status));
+    xfer_status.protocol = req.protocol;
+    xfer_status.total = i_size_read(file_inode(file));
+    
+    ret = uart_xfer_send_file(file, req.protocol);
+    
+    xfer_status.result = ret;
+    xfer_status.state = ret ? UART_XFER_FAILED : UART_XFER_DONE;
+    
+    mutex_unlock(&uart_tx_mutex);
+    uart_rx_fifo_unclaim();
+    mutex_unlock(&uart_rx_mutex);
+    fput(file);
+    
+    pr_info("UART transfer finished: %llu/%llu bytes, %u retries, result %d\n",
+            xfer_status.bytes, xfer_status.total, xfer_status.retries, ret);
+    return ret;
+}
+
+// Transmit a range of another file straight from the kernel, the TX
+// counterpart of splicing from /proc/uart_rx. Returns bytes sent.
+static long uart_tx_sendfile(void __user *argp)
+{
+    struct uart_tx_sendfile req;
+    struct file *file;
+    loff_t pos;
+    ssize_t n = 0;
+    u64 sent = 0;
+    u8 *buf;
+    
+    if (copy_from_user(&req, argp, sizeof(req))) {
+        return -EFAULT;
+    }
+    
+    file = fget(req.fd);
+    if (!file) {
+        return -EBADF;
+    }
+    
+    buf = kmalloc(UART_COMP_MAX_RAW, GFP_KERNEL);
+    if (!buf) {
+        fput(file);
+        return -ENOMEM;
+    }
+    
+    pos = req.offset;
+    while (!req.count || sent < req.count) {
+        // Any signal ends the transfer; report what already went out
+        if (signal_pending(current)) {
+            n = -ERESTARTSYS;
+            break;
+        }
+        
+        n = kernel_read(file, buf, req.count ?
+                        min_t(u64, req.count - sent, UART_COMP_MAX_RAW) :
+                        UART_COMP_MAX_RAW, &pos);
+        if (n <= 0) {
+            break;
+        }
+        
+        // Release the transmitter between chunks so other writers interleave
+        if (compress_mode) {
+            uart_comp_send(buf, n);
+        } else {
+            mutex_lock(&uart_tx_mutex);
+            uart_send_raw_locked(buf, n);
+            mutex_unlock(&uart_tx_mutex);
+        }
+        sent += n;
+    }
+    
+    kfree(buf);
+    fput(file);
+    
+    if (n < 0 && !sent) {
+        return n;
+    }
+    return sent;
+}
+
+// Validate a job and copy its frame in from user space
+static int uart_periodic_fetch(const struct uart_periodic *job, u8 *frame)
+{
+    if (job->len == 0 || job->len > UART_PERIODIC_MAX ||
+        job->break_us > UART_PERIODIC_BREAK_MAX ||
+        job->mab_us > UART_PERIODIC_MAB_MAX) {
+        return -EINVAL;
+    }
+    
+    if (copy_from_user(frame, u64_to_user_ptr(job->data), job->len)) {
+        return -EFAULT;
+    }
+    
+    return 0;
+}
+
+// Swap in a new frame and timing; period_us == 0 keeps the current period
+static void uart_periodic_install(const struct uart_periodic *job, const u8 *frame)
+{
+    spin_lock_irq(&periodic_lock);
+    memcpy(periodic_buf, frame, job->len);
+    periodic_len = job->len;
+    periodic_break_us = job->break_us;
+    periodic_mab_us = job->mab_us;
+    if (job->period_us) {
+        periodic_period = us_to_ktime(job->period_us);
+        periodic_stats.period_us = job->period_us;
+    }
+    periodic_stats.len = job->len;
+    spin_unlock_irq(&periodic_lock);
+}
+
+static void uart_periodic_stop(void)
+{
+    mutex_lock(&periodic_mutex);
+    if (periodic_active) {
+        hrtimer_cancel(&periodic_timer);
+        
+        // Let a frame in progress finish so the bus never sees a runt
+        mutex_lock(&uart_tx_mutex);
+        periodic_pending = false;
+        mutex_unlock(&uart_tx_mutex);
+        while (READ_ONCE(periodic_tx_len)) {
+            usleep_range(100, 200);
+        }
+        
+        uart_service_put();
+        periodic_active = false;
+        pr_info("Periodic TX stopped after %llu frames\n", periodic_stats.frames);
+    }
+    mutex_unlock(&periodic_mutex);
+}
+
+static long uart_periodic_ioctl(unsigned int cmd, void __user *argp)
+{
+    struct uart_periodic job;
+    u8 *frame;
+    long ret;
+    
+    if (copy_from_user(&job, argp, sizeof(job))) {
+        return -EFAULT;
+    }
+    if (cmd == UART_IOC_PERIODIC_START && job.period_us < UART_PERIODIC_MIN_US) {
+        return -EINVAL;
+    }
+    
+    frame = kmalloc(UART_PERIODIC_MAX, GFP_KERNEL);
+    if (!frame) {
+        return -ENOMEM;
+    }
+    
+    ret = uart_periodic_fetch(&job, frame);
+    if (ret) {
+        goto out;
+    }
+    
+    mutex_lock(&periodic_mutex);
+    if (cmd == UART_IOC_PERIODIC_UPDATE) {
+        if (!periodic_active) {
+            ret = -ENOENT;
+        } else if (job.period_us && job.period_us < UART_PERIODIC_MIN_US) {
+            ret = -EINVAL;
+        } else {
+            uart_periodic_install(&job, frame);
+        }
+    } else if (periodic_active) {
+        ret = -EBUSY;
+    } else {
+        ret = uart_service_get();
+        if (ret == 0) {
+            memset(&periodic_stats, 0, sizeof(periodic_stats));
+            periodic_jitter_sum = 0;
+            uart_periodic_install(&job, frame);
+            
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+            hrtimer_setup(&periodic_timer, uart_periodic_fire, CLOCK_MONOTONIC,
+                          HRTIMER_MODE_REL);
+#else
+            hrtimer_init(&periodic_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+            periodic_timer.function = uart_periodic_fire;
+#endif
+            hrtimer_start(&periodic_timer, periodic_period, HRTIMER_MODE_REL);
+            periodic_active = true;
+            pr_info("Periodic TX started: %u bytes every %u us\n",
+                    job.len, job.period_us);
+        }
+    }
+    mutex_unlock(&periodic_mutex);
+    
+out:
+    kfree(frame);
+    return ret;
+}
+
+// Snapshot the job counters; jitter_avg_ns is the mean absolute jitter
+static long uart_periodic_get_stats(void __user *argp)
+{
+    struct uart_periodic_stats st;
+    
+    spin_lock_irq(&periodic_lock);
+    st = periodic_stats;
+    spin_unlock_irq(&periodic_lock);
+    st.jitter_avg_ns = st.frames ? div64_u64(periodic_jitter_sum, st.frames) : 0;
+    
+    if (copy_to_user(argp, &st, sizeof(st))) {
+        return -EFAULT;
+    }
+    return 0;
+}
+
+// ioctl handler on /proc/uart_tx
+static long uart_tx_ioctl(struct file *file, unsigned int cmd,
+                          unsigned long arg)
+{
+    void __user *argp = (void __user *)arg;
+    
+    switch (cmd) {
+    case UART_IOC_XFER_SEND:
+        return uart_xfer_ioctl_send(argp);
+    case UART_IOC_TX_SENDFILE:
+        return uart_tx_sendfile(argp);
+    case UART_IOC_XFER_STATUS:
+        if (copy_to_user(argp, &xfer_status, sizeof(xfer_status))) {
+            return -EFAULT;
+        }
+        return 0;
+    case UART_IOC_PERIODIC_START:
+    case UART_IOC_PERIODIC_UPDATE:
+        return uart_periodic_ioctl(cmd, argp);
+    case UART_IOC_PERIODIC_STOP:
+        uart_periodic_stop();
+        return 0;
+    case UART_IOC_PERIODIC_STATS:
+        return uart_periodic_get_stats(argp);
+    case UART_IOC_TX_CORK:
+        return uart_tx_cork(file->private_data);
+    case UART_IOC_TX_UNCORK:
+        return uart_tx_uncork(file->private_data);
+    default:
+        return -ENOTTY;
+    }
+}
+
+// Configuration read handler
+static ssize_t uart_config_read(struct file *file, char __user *buf,
+                                size_t count, loff_t *ppos)
+{
+    char *kbuf;
+    size_t size = PAGE_SIZE;
+    int len;
+    
+    if (*ppos > 0) {
+        return 0;
+    }
+    
+    kbuf = kmalloc(size, GFP_KERNEL);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+    
+    len = scnprintf(kbuf, size,
+        "UART Configuration\n"
+        "==================\n"
+        "Baudrate: %u\n"
+        "Data bits: %s\n"
+        "System clock: %u Hz\n"
+        "RX mode: %s\n"
+        "RX history: %u KB, %u s (0 = no limit)\n"
+        "Compression: %s\n"
+        "Network interface: %s\n"
+        "Address filter: %s (%u addresses, offset %u, gap %u chars)\n"
+        "Auto-response slots: %u\n"
+        "Remote loopback: %s\n"
+        "Service idle backoff: up to %u chars\n"
+        "\nSupported baud rates:\n"
+        "  9600, 19200, 38400, 57600, 115200\n"
+        "\nTo change configuration, write:\n"
+        "  echo \"baud=115200\" > /proc/uart_config\n"
+        "  echo \"bits=7\" > /proc/uart_config\n"
+        "  echo \"rx_mode=service\" > /proc/uart_config\n"
+        "  echo \"compress=lz4\" > /proc/uart_config\n"
+        "  echo \"history_kb=16\" > /proc/uart_config\n"
+        "  echo \"addr_filter=0x11,0x12\" > /proc/uart_config\n"
+        "  echo \"autoresp=0:01030000:0103020000\" > /proc/uart_config\n"
+        "  echo \"bert_tx=prbs15\" > /proc/uart_config\n"
+        "  echo \"capture_trigger=pattern,overrun,tx_stall\" > /proc/uart_config\n"
+        "  echo \"capture_pattern=7e01\" > /proc/uart_config\n"
+        "  echo \"capture=arm\" > /proc/uart_config\n"
+        "  echo \"clear_fifo\" > /proc/uart_config\n",
+        config.baudrate,
+        (config.data_bits == DATA_BITS_8) ? "8" : "7",
+        config.system_clock,
+        rx_service_mode ? "service" : "poll",
+        rx_history_bytes / 1024, rx_history_sec,
+        compress_mode ? "lz4" : "off",
+        rcu_access_pointer(uart_net_dev) ? "on" : "off",
+        addr_filter_mode ? "on" : "off", addr_count, addr_offset, addr_gap_chars,
+        uart_ar_active,
+        echo_mode ? "on" : "off",
+        svc_idle_chars);
+    
+    if (len > count) {
+        len = count;
+    }
+    
+    if (copy_to_user(buf, kbuf, len)) {
+        kfree(kbuf);
+        return -EFAULT;
+    }
+    
+    kfree(kbuf);
+    *ppos += len;
+    return len;
+}
+
+// Configuration write handler
+#define UART_CONFIG_CMD_MAX 640  // fits the longest autoresp= line
+
+// Serializes configuration changes from /proc/uart_config and configfs
+static DEFINE_MUTEX(uart_cfg_mutex);
+
+// Run one /proc/uart_config command
+static int uart_config_cmd(char *kbuf)
+{
+    u32 new_baud;
+    u32 value;
+    
+    // Parse baud rate command
+    if (sscanf(kbuf, "baud=%u", &new_baud) == 1) {
+        // Validate baud rate
+        if (!uart_baud_supported(new_baud)) {
+            pr_err("Unsupported baud rate: %u\n", new_baud);
+            return -EINVAL;
+        }
+        
+        config.baudrate = new_baud;
+        if (uart_apply_config() != 0) {
+            pr_err("Failed to apply baud rate configuration\n");
+            return -EINVAL;
+        }
+        
+        pr_info("Baud rate changed to %u\n", new_baud);
+    }
+    // Parse data bits command
+    else if (strncmp(kbuf, "bits=8", 6) == 0) {
+        config.data_bits = DATA_BITS_8;
+        if (uart_apply_config() != 0) {
+            return -EINVAL;
+        }
+        pr_info("Data bits changed to 8\n");
+    }
+    else if (strncmp(kbuf, "bits=7", 6) == 0) {
+        config.data_bits = DATA_BITS_7;
+        if (uart_apply_config() != 0) {
+            return -EINVAL;
+        }
+        pr_info("Data bits changed to 7\n");
+    }
+    // Select how /proc/uart_rx gets its data
+    else if (strncmp(kbuf, "rx_mode=service", 15) == 0) {
+        if (uart_set_rx_service_mode(true) != 0) {
+            return -EIO;
+        }
+        pr_info("RX mode changed to service\n");
+    }
+    else if (strncmp(kbuf, "rx_mode=poll", 12) == 0) {
+        if (compress_mode) {
+            pr_err("rx_mode=poll is not available with compression\n");
+            return -EBUSY;
+        }
+        uart_set_rx_service_mode(false);
+        pr_info("RX mode changed to poll\n");
+    }
+    // Framed link compression
+    else if (strncmp(kbuf, "compress=lz4", 12) == 0) {
+        if (uart_set_compress_mode(true) != 0) {
+            return -EIO;
+        }
+        pr_info("Link compression enabled (LZ4)\n");
+    }
+    else if (strncmp(kbuf, "compress=off", 12) == 0) {
+        uart_set_compress_mode(false);
+        pr_info("Link compression disabled\n");
+    }
+    // SLIP network interface
+    else if (strncmp(kbuf, "net=on", 6) == 0) {
+        if (uart_set_net_mode(true) != 0) {
+            return -EIO;
+        }
+        pr_info("Network interface enabled\n");
+    }
+    else if (strncmp(kbuf, "net=off", 7) == 0) {
+        uart_set_net_mode(false);
+        pr_info("Network interface disabled\n");
+    }
+    // Service thread idle backoff
+    else if (sscanf(kbuf, "svc_idle_chars=%u", &value) == 1) {
+        if (value < UART_FIFO_DEPTH / 2 || value > 1024) {
+            pr_err("svc_idle_chars must be %d to 1024\n", UART_FIFO_DEPTH / 2);
+            return -EINVAL;
+        }
+        WRITE_ONCE(svc_idle_chars, value);
+        pr_info("Service idle backoff capped at %u character times\n", value);
+    }
+    // Bit error rate tester
+    else if (strncmp(kbuf, "bert_tx=", 8) == 0) {
+        struct uart_bert b;
+        
+        if (uart_bert_parse(strim(kbuf + 8), &b) != 0) {
+            pr_err("BERT pattern must be prbs7, prbs15, prbs23 or off\n");
+            return -EINVAL;
+        }
+        if (b.order && uart_set_rx_service_mode(true) != 0) {
+            return -EIO;
+        }
+        uart_bert_set_tx(&b);
+        pr_info("BERT generator %s\n", b.order ? "started" : "stopped");
+    }
+    else if (strncmp(kbuf, "bert_rx=", 8) == 0) {
+        struct uart_bert b;
+        
+        if (uart_bert_parse(strim(kbuf + 8), &b) != 0) {
+            pr_err("BERT pattern must be prbs7, prbs15, prbs23 or off\n");
+            return -EINVAL;
+        }
+        if (b.order && uart_set_rx_service_mode(true) != 0) {
+            return -EIO;
+        }
+        uart_bert_set_rx(&b);
+        pr_info("BERT checker %s\n", b.order ? "started" : "stopped");
+    }
+    // Remote loopback
+    else if (strncmp(kbuf, "echo=on", 7) == 0) {
+        if (uart_set_rx_service_mode(true) != 0) {
+            return -EIO;
+        }
+        echo_mode = true;
+        pr_info("Remote loopback enabled\n");
+    }
+    else if (strncmp(kbuf, "echo=off", 8) == 0) {
+        echo_mode = false;
+        pr_info("Remote loopback disabled\n");
+    }
+    // Auto-response table
+    else if (strncmp(kbuf, "autoresp=off", 12) == 0) {
+        uart_ar_clear();
+        pr_info("Auto-response table cleared\n");
+    }
+    else if (strncmp(kbuf, "autoresp=", 9) == 0) {
+        if (uart_ar_set(strim(kbuf + 9)) != 0) {
+            pr_err("Auto-response takes <slot 0-%d>:<match hex>:<response hex>\n",
+                   UART_AR_SLOTS - 1);
+            return -EINVAL;
+        }
+        if (uart_set_rx_service_mode(true) != 0) {
+            return -EIO;
+        }
+        pr_info("Auto-response table updated (%u slots active)\n", uart_ar_active);
+    }
+    // Multi-drop address filter
+    else if (strncmp(kbuf, "addr_filter=off", 15) == 0) {
+        addr_filter_mode = false;
+        pr_info("Address filter disabled\n");
+    }
+    else if (strncmp(kbuf, "addr_filter=", 12) == 0) {
+        u8 addrs[UART_ADDR_MAX];
+        u32 n;
+        
+        if (uart_addr_parse(strim(kbuf + 12), addrs, &n) != 0) {
+            pr_err("Address filter takes up to %d addresses\n", UART_ADDR_MAX);
+            return -EINVAL;
+        }
+        if (uart_set_rx_service_mode(true) != 0) {
+            return -EIO;
+        }
+        uart_addr_set(addrs, n);
+        addr_filter_mode = true;
+        pr_info("Address filter enabled (%u addresses)\n", n);
+    }
+    else if (sscanf(kbuf, "addr_offset=%u", &value) == 1) {
+        if (value >= UART_ADDR_FRAME_MAX) {
+            return -EINVAL;
+        }
+        addr_offset = value;
+        pr_info("Address offset set to %u\n", value);
+    }
+    else if (strncmp(kbuf, "addr_broadcast=none", 19) == 0) {
+        addr_broadcast = UART_ADDR_NONE;
+        pr_info("Broadcast address disabled\n");
+    }
+    else if (sscanf(kbuf, "addr_broadcast=%i", &value) == 1) {
+        if (value > 0xFF) {
+            return -EINVAL;
+        }
+        addr_broadcast = value;
+        pr_info("Broadcast address set to 0x%02x\n", value);
+    }
+    else if (sscanf(kbuf, "addr_gap=%u", &value) == 1) {
+        if (value < UART_ADDR_GAP_MIN) {
+            pr_err("Frame gap must be at least %d character times\n",
+                   UART_ADDR_GAP_MIN);
+            return -EINVAL;
+        }
+        addr_gap_chars = value;
+        pr_info("Frame gap set to %u character times\n", value);
+    }
+    // History retained for late readers
+    else if (sscanf(kbuf, "history_kb=%u", &value) == 1) {
+        if (value == 0 || value > UART_RX_BUF_SIZE / 1024) {
+            pr_err("History must be 1-%d KB\n", UART_RX_BUF_SIZE / 1024);
+            return -EINVAL;
+        }
+        rx_history_bytes = value * 1024;
+        pr_info("RX history set to %u KB\n", value);
+    }
+    else if (sscanf(kbuf, "history_sec=%u", &value) == 1) {
+        rx_history_sec = value;
+        pr_info("RX history time limit set to %u s\n", value);
+    }
+    // Trigger-armed capture
+    else if (strncmp(kbuf, "capture=arm", 11) == 0) {
+        uart_cap_arm(true);
+        pr_info("Capture armed\n");
+    }
+    else if (strncmp(kbuf, "capture=off", 11) == 0) {
+        uart_cap_arm(false);
+        pr_info("Capture disabled\n");
+    }
+    else if (sscanf(kbuf, "capture_post=%u", &value) == 1) {
+        if (value >= UART_CAP_RECORDS) {
+            return -EINVAL;
+        }
+        spin_lock(&uart_cap_lock);
+        cap_post = value;
+        spin_unlock(&uart_cap_lock);
+        pr_info("Capture post-trigger records: %u\n", value);
+    }
+    else if (strncmp(kbuf, "capture_pattern=", 16) == 0) {
+        char *hex = strim(kbuf + 16);
+        size_t hlen = strlen(hex);
+        u8 pattern[UART_CAP_PATTERN_MAX];
+        
+        if (hlen % 2 || hlen / 2 > UART_CAP_PATTERN_MAX ||
+            hex2bin(pattern, hex, hlen / 2)) {
+            pr_err("Capture pattern must be up to %d hex bytes\n",
+                   UART_CAP_PATTERN_MAX);
+            return -EINVAL;
+        }
+        
+        // The matcher reads the pattern under the lock, from RX context
+        spin_lock(&uart_cap_lock);
+        memcpy(cap_pattern, pattern, hlen / 2);
+        cap_pattern_len = hlen / 2;
+        cap_trigger_mask |= UART_CAP_TRIG_PATTERN;
+        spin_unlock(&uart_cap_lock);
+        pr_info("Capture pattern set (%zu bytes)\n", hlen / 2);
+    }
+    else if (strncmp(kbuf, "capture_trigger=", 16) == 0) {
+        char *opts = strim(kbuf + 16);
+        char *tok;
+        u32 mask = 0;
+        
+        while ((tok = strsep(&opts, ",")) != NULL) {
+            if (strcmp(tok, "pattern") == 0) {
+                mask |= UART_CAP_TRIG_PATTERN;
+            } else if (strcmp(tok, "overrun") == 0) {
+                mask |= UART_CAP_TRIG_OVERRUN;
+            } else if (strcmp(tok, "tx_stall") == 0) {
+                mask |= UART_CAP_TRIG_TX_STALL;
+            } else {
+                pr_err("Unknown capture trigger: %s\n", tok);
+                return -EINVAL;
+            }
+        }
+        spin_lock(&uart_cap_lock);
+        cap_trigger_mask = mask;
+        spin_unlock(&uart_cap_lock);
+        pr_info("Capture triggers set to 0x%x\n", mask);
+    }
+    // Clear FIFO command
+    else if (strncmp(kbuf, "clear_fifo", 10) == 0) {
+        uart_clear_fifos();
+        pr_info("FIFOs cleared\n");
+    }
+    // Reset statistics
+    else if (strncmp(kbuf, "reset_stats", 11) == 0) {
+        memset(&stats, 0, sizeof(stats));
+        memset(&cost, 0, sizeof(cost));
+        atomic64_set(&uart_con_bytes, 0);
+        atomic64_set(&uart_con_drops, 0);
+        spin_lock_irq(&periodic_lock);
+        periodic_stats.frames = 0;
+        periodic_stats.missed = 0;
+        periodic_stats.jitter_min_ns = 0;
+        periodic_stats.jitter_max_ns = 0;
+        periodic_jitter_sum = 0;
+        spin_unlock_irq(&periodic_lock);
+        bert_tx_start_ns = local_clock();
+        bert_rx_start_ns = bert_tx_start_ns;
+        uart_lat_reset();
+        pr_info("Statistics reset\n");
+    }
+    else {
+        pr_err("Invalid command. Use: baud=<rate>, bits=<7|8>, rx_mode=<poll|service>, compress=<lz4|off>, net=<on|off>, echo=<on|off>, svc_idle_chars=<n>, bert_tx=<prbsN|off>, bert_rx=<prbsN|off>, autoresp=<slot:match:resp|off>, addr_filter=<list|off>, addr_offset=<n>, addr_broadcast=<n|none>, addr_gap=<chars>, history_kb=<n>, history_sec=<n>, capture=<arm|off>, capture_post=<n>, capture_pattern=<hex>, capture_trigger=<list>, clear_fifo, or reset_stats\n");
+        return -EINVAL;
+    }
+    
+    return 0;
+}
+
+static ssize_t uart_config_write(struct file *file,
+    const char __user *buf, size_t count, loff_t *ppos)
+{
+    char *kbuf;
+    int ret;
+    
+    kbuf = memdup_user_nul(buf, min_t(size_t, count, UART_CONFIG_CMD_MAX));
+    if (IS_ERR(kbuf)) {
+        return PTR_ERR(kbuf);
+    }
+    
+    mutex_lock(&uart_cfg_mutex);
+    ret = uart_config_cmd(kbuf);
+    mutex_unlock(&uart_cfg_mutex);
+    kfree(kbuf);
+    
+    return ret ? ret : count;
+}
+
+// Status read handler
+static ssize_t uart_status_read(struct file *file, char __user *buf,
+                                size_t count, loff_t *ppos)
+{
+    static const char * const xfer_states[] = {
+        "idle", "waiting for receiver", "sending", "done", "failed"
+    };
+    static const char * const cap_states[] = {
+        "off", "armed", "triggered", "frozen"
+    };
+    char kbuf[768];
+    int len;
+    u32 lsr, stat;
+    
+    if (*ppos > 0) {
+        return 0;
+    }
+    
+    lsr = readl(&uart->MU_LSR);
+    stat = readl(&uart->MU_STAT);
+    
+    len = snprintf(kbuf, sizeof(kbuf),
+        "UART Status\n"
+        "===========\n"
+        "TX FIFO empty: %s\n"
+        "TX FIFO full: %s\n"
+        "RX FIFO has data: %s\n"
+        "RX FIFO overrun: %s\n"
+        "TX FIFO level: %u\n"
+        "RX FIFO level: %u\n",
+        (lsr & (1 << 5)) ? "Yes" : "No",
+        (stat & (1 << 9)) ? "Yes" : "No",
+        (lsr & (1 << 0)) ? "Yes" : "No",
+        (lsr & (1 << 1)) ? "Yes (ERROR!)" : "No",
+        (stat >> 24) & 0xF,
+        (stat >> 16) & 0xF);
+    
+    len += scnprintf(kbuf + len, sizeof(kbuf) - len,
+        "File transfer: %s\n"
+        "  Bytes: %llu/%llu\n"
+        "  Blocks: %u, retries: %u, result: %d\n",
+        xfer_states[xfer_status.state],
+        xfer_status.bytes, xfer_status.total,
+        xfer_status.blocks, xfer_status.retries, xfer_status.result);
+    
+    len += scnprintf(kbuf + len, sizeof(kbuf) - len,
+        "Capture: %s, %u records\n",
+        cap_states[cap_state],
+        min_t(u32, cap_head, UART_CAP_RECORDS));
+    
+    if (len > count) {
+        len = count;
+    }
+    
+    if (copy_to_user(buf, kbuf, len)) {
+        return -EFAULT;
+    }
+    
+    *ppos += len;
+    return len;
+}
+
+// Format one busy-vs-sleep breakdown line for a service path
+static int uart_cost_show(char *buf, size_t size, const char *name,
+                          u64 time_ns, u64 sleep_ns, u64 bytes)
+{
+    u64 busy_ns = time_ns - min(sleep_ns, time_ns);
+    
+    return scnprintf(buf, size,
+        "%s: busy %llu us, sleep %llu us, %llu ns/byte busy, %llu ns/byte total\n",
+        name,
+        div_u64(busy_ns, NSEC_PER_USEC),
+        div_u64(sleep_ns, NSEC_PER_USEC),
+        bytes ? div64_u64(busy_ns, bytes) : 0,
+        bytes ? div64_u64(time_ns, bytes) : 0);
+}
+
+// Statistics read handler
+static ssize_t uart_stats_read(struct file *file, char __user *buf,
+                               size_t count, loff_t *ppos)
+{
+    char *kbuf;
+    size_t size = PAGE_SIZE;
+    u64 now, tx_ms, rx_ms;
+    int len;
+    int i;
+    
+    if (*ppos > 0) {
+        return 0;
+    }
+    
+    kbuf = kmalloc(size, GFP_KERNEL);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+    
+    len = scnprintf(kbuf, size,
+        "UART Statistics\n"
+        "===============\n"
+        "TX bytes: %llu\n"
+        "RX bytes: %llu\n"
+        "TX errors: %llu\n"
+        "RX errors: %llu\n"
+        "FIFO overruns: %llu\n"
+        "RX buffer drops: %llu\n"
+        "RX filter drops: %llu\n"
+        "RX filter bursts judged on a prefix: %llu\n"
+        "Address filter frames accepted/filtered: %llu/%llu\n"
+        "TX gaps > 1.5 chars mid-frame: %llu\n"
+        "Loopback echoed/dropped: %llu/%llu\n"
+        "Console bytes: %llu\n"
+        "Console drops: %llu\n",
+        stats.tx_bytes,
+        stats.rx_bytes,
+        stats.tx_errors,
+        stats.rx_errors,
+        stats.fifo_overruns,
+        stats.rx_buffer_drops,
+        stats.rx_filter_drops,
+        stats.rx_filter_truncated,
+        stats.addr_accepted,
+        stats.addr_filtered,
+        stats.tx_gaps,
+        stats.echo_bytes,
+        stats.echo_drops,
+        atomic64_read(&uart_con_bytes),
+        atomic64_read(&uart_con_drops));
+    
+    len += scnprintf(kbuf + len, size - len,
+        "\nCompression\n"
+        "TX raw/wire bytes: %llu/%llu (ratio x%llu.%02llu)\n"
+        "RX raw/wire bytes: %llu/%llu\n"
+        "RX frame errors: %llu\n"
+        "Compress time: %llu us, decompress time: %llu us\n",
+        stats.comp_tx_raw, stats.comp_tx_wire,
+        stats.comp_tx_wire ? div64_u64(stats.comp_tx_raw, stats.comp_tx_wire) : 0,
+        stats.comp_tx_wire ? div64_u64(stats.comp_tx_raw * 100, stats.comp_tx_wire) % 100 : 0,
+        stats.comp_rx_raw, stats.comp_rx_wire,
+        stats.comp_rx_errors,
+        div_u64(cost.comp_ns, NSEC_PER_USEC),
+        div_u64(cost.decomp_ns, NSEC_PER_USEC));
+    
+    len += scnprintf(kbuf + len, size - len,
+        "\nAuto-response\n"
+        "Responses sent: %llu, dropped while busy: %llu\n",
+        stats.ar_responses, stats.ar_busy);
+    spin_lock(&uart_ar_lock);
+    for (i = 0; i < UART_AR_SLOTS; i++) {
+        if (uart_ar_table[i].match_len) {
+            len += scnprintf(kbuf + len, size - len, "Slot %d hits: %llu\n",
+                             i, uart_ar_table[i].hits);
+        }
+    }
+    spin_unlock(&uart_ar_lock);
+    
+    now = local_clock();
+    tx_ms = div_u64(now - bert_tx_start_ns, NSEC_PER_MSEC);
+    rx_ms = div_u64(now - bert_rx_start_ns, NSEC_PER_MSEC);
+    len += scnprintf(kbuf + len, size - len,
+        "\nBERT\n"
+        "TX: prbs%u, %llu bytes, %llu bit/s\n"
+        "RX: prbs%u, %s, %llu bits, %llu bit errors, %llu byte errors, %llu resyncs\n"
+        "RX rate: %llu bit/s\n"
+        "BER: ",
+        bert_gen.order, stats.bert_tx_bytes,
+        (bert_gen.order && tx_ms) ?
+            div64_u64(stats.bert_tx_bytes * uart_bert_char_bits() * MSEC_PER_SEC, tx_ms) : 0,
+        bert_chk.order, bert_locked ? "locked" : "searching",
+        stats.bert_rx_bits, stats.bert_bit_errors, stats.bert_byte_errors,
+        stats.bert_resyncs,
+        (bert_chk.order && rx_ms) ?
+            div64_u64(stats.bert_rx_bits * MSEC_PER_SEC, rx_ms) : 0);
+    len += uart_bert_show_ber(kbuf + len, size - len,
+                              stats.bert_bit_errors, stats.bert_rx_bits);
+    len += scnprintf(kbuf + len, size - len, "\n");
+    
+    len += scnprintf(kbuf + len, size - len,
+        "\nPeriodic TX\n"
+        "Frames sent/missed: %llu/%llu\n"
+        "Start jitter min/avg/max: %lld/%llu/%lld ns\n",
+        periodic_stats.frames, periodic_stats.missed,
+        periodic_stats.jitter_min_ns,
+        periodic_stats.frames ? div64_u64(periodic_jitter_sum, periodic_stats.frames) : 0,
+        periodic_stats.jitter_max_ns);
+    
+    len += scnprintf(kbuf + len, size - len, "\nCPU cost\n");
+    len += uart_cost_show(kbuf + len, size - len, "TX polled",
+                          cost.tx_time_ns, cost.tx_sleep_ns, cost.tx_bytes);
+    len += uart_cost_show(kbuf + len, size - len, "RX polled",
+                          cost.rx_time_ns, cost.rx_sleep_ns, cost.rx_bytes);
+    len += uart_cost_show(kbuf + len, size - len, "Service",
+                          cost.svc_time_ns, cost.svc_sleep_ns, cost.svc_bytes);
+    len += scnprintf(kbuf + len, size - len,
+        "Service wakeups: %llu (%llu idle)\n",
+        cost.svc_wakeups, cost.svc_idle_wakeups);
+    
+    len += scnprintf(kbuf + len, size - len,
+        "\nTo reset: echo \"reset_stats\" > /proc/uart_config\n");
+    
+    if (len > count) {
+        len = count;
+    }
+    
+    if (copy_to_user(buf, kbuf, len)) {
+        kfree(kbuf);
+        return -EFAULT;
+    }
+    
+    kfree(kbuf);
+    *ppos += len;
+    return len;
+}
+
+// Capture readout: the frozen window as struct uart_cap_record, oldest first
+static ssize_t uart_capture_read(struct file *file, char __user *buf,
+                                 size_t count, loff_t *ppos)
+{
+    struct uart_cap_record *rec;
+    u32 nrec, first, idx;
+    size_t done = 0;
+    
+    if (READ_ONCE(cap_state) != UART_CAP_FROZEN) {
+        return 0;
+    }
+    
+    nrec = min_t(u32, cap_head, UART_CAP_RECORDS);
+    first = cap_head - nrec;
+    idx = div_u64(*ppos, sizeof(*rec));
+    
+    while (idx < nrec && count - done >= sizeof(*rec)) {
+        rec = &cap_buf[(first + idx) % UART_CAP_RECORDS];
+        if (copy_to_user(buf + done, rec, sizeof(*rec))) {
+            return -EFAULT;
+        }
+        done += sizeof(*rec);
+        idx++;
+    }
+    
+    *ppos += done;
+    return done;
+}
+
+// Flight recorder readout: the previous boot's records, oldest first
+static ssize_t uart_flight_read(struct file *file, char __user *buf,
+                                size_t count, loff_t *ppos)
+{
+    size_t total = (size_t)flight_prev_count * sizeof(*flight_prev);
     size_t len;
-    u32 new_baud;
     
-    len = min(count, sizeof(kbuf) - 1);
+    if (*ppos >= total) {
+        return 0;
+    }
+    
+    len = min_t(size_t, count, total - *ppos);
+    if (copy_to_user(buf, (u8 *)flight_prev + *ppos, len)) {
+        return -EFAULT;
+    }
+    
+    *ppos += len;
+    return len;
+}
+
+// Per-file and per-process I/O accounting; seq_file grows the buffer
+// as far as the listing needs
+static int uart_io_show(struct seq_file *m, void *v)
+{
+    struct uart_io_acct *a;
+    struct uart_io_proc *p, sum;
+    
+    seq_printf(m, "UART I/O by open file\n"
+        "%-7s %-16s %3s %12s %8s %12s %12s %10s\n",
+        "PID", "COMM", "DIR", "BYTES", "OPS", "BLOCKED_US", "QUEUED_US", "DROPS");
+    
+    spin_lock(&uart_io_lock);
+    list_for_each_entry(a, &uart_io_files, node) {
+        seq_printf(m, "%-7d %-16s %3c %12llu %8llu %12llu %12llu %10llu\n",
+            a->pid, a->comm, a->dir, a->bytes, a->ops,
+            div_u64(a->block_ns, NSEC_PER_USEC),
+            div_u64(a->queue_ns, NSEC_PER_USEC), a->drops);
+    }
+    
+    seq_printf(m, "\nUART I/O by process, open and closed files\n"
+        "%-7s %-16s %5s %12s %12s %12s %12s %10s\n",
+        "PID", "COMM", "OPEN", "TX_BYTES", "RX_BYTES", "BLOCKED_US",
+        "QUEUED_US", "DROPS");
+    
+    // Closed files are already folded in; add the open ones
+    list_for_each_entry(p, &uart_io_procs, node) {
+        sum = *p;
+        list_for_each_entry(a, &uart_io_files, node) {
+            if (a->proc == p) {
+                uart_io_proc_fold(&sum, a);
+            }
+        }
+        
+        seq_printf(m, "%-7d %-16s %5u %12llu %12llu %12llu %12llu %10llu\n",
+            p->pid, p->comm, p->open_files, sum.tx_bytes, sum.rx_bytes,
+            div_u64(sum.block_ns, NSEC_PER_USEC),
+            div_u64(sum.queue_ns, NSEC_PER_USEC), sum.drops);
+    }
+    spin_unlock(&uart_io_lock);
+    
+    return 0;
+}
+
+static int uart_io_open(struct inode *inode, struct file *file)
+{
+    return single_open(file, uart_io_show, NULL);
+}
+
+// RX delivery latency percentiles per RX mode and baud rate
+static ssize_t uart_latency_read(struct file *file, char __user *buf,
+                                 size_t count, loff_t *ppos)
+{
+    static const char * const modes[UART_LAT_MODES] = { "poll", "service" };
+    struct uart_lat_hist *h;
+    char *kbuf;
+    size_t size = PAGE_SIZE;
+    int len, m, b;
+    
+    if (*ppos > 0) {
+        return 0;
+    }
+    
+    kbuf = kmalloc(size, GFP_KERNEL);
+    if (!kbuf) {
+        return -ENOMEM;
+    }
+    
+    len = scnprintf(kbuf, size,
+        "UART RX delivery latency (est. FIFO arrival to user copy, first byte)\n"
+        "%-8s %7s %10s %10s %10s %10s %10s\n",
+        "MODE", "BAUD", "SAMPLES", "P50_US", "P99_US", "P99.9_US", "MAX_US");
+    
+    h = kmalloc(sizeof(*h), GFP_KERNEL);
+    if (!h) {
+        kfree(kbuf);
+        return -ENOMEM;
+    }
+    
+    for (m = 0; m < UART_LAT_MODES; m++) {
+        for (b = 0; b < UART_LAT_BAUDS; b++) {
+            // Percentiles are taken from a snapshot, not under the lock
+            spin_lock(&uart_lat_lock);
+            *h = uart_lat[m][b];
+            spin_unlock(&uart_lat_lock);
+            
+            if (!h->count) {
+                continue;
+            }
+            
+            len += scnprintf(kbuf + len, size - len,
+                "%-8s %7u %10llu %10llu %10llu %10llu %10llu\n",
+                modes[m], uart_lat_bauds[b], h->count,
+                div_u64(uart_lat_percentile(h, 500), NSEC_PER_USEC),
+                div_u64(uart_lat_percentile(h, 990), NSEC_PER_USEC),
+                div_u64(uart_lat_percentile(h, 999), NSEC_PER_USEC),
+                div_u64(h->max_ns, NSEC_PER_USEC));
+        }
+    }
+    kfree(h);
+    
+    len += scnprintf(kbuf + len, size - len,
+        "\nCurrent: %s at %u baud; reset with reset_stats\n",
+        rx_service_mode ? "service" : "poll", config.baudrate);
+    
+    if (len > count) {
+        len = count;
+    }
+    
+    if (copy_to_user(buf, kbuf, len)) {
+        kfree(kbuf);
+        return -EFAULT;
+    }
+    
+    kfree(kbuf);
+    *ppos += len;
+    return len;
+}
+
+// Proc operations
+static const struct proc_ops uart_tx_proc_ops = {
+    .proc_open = uart_tx_open,
+    .proc_release = uart_tx_release,
+    .proc_write = uart_proc_write,
+    .proc_ioctl = uart_tx_ioctl,
+    .proc_compat_ioctl = compat_ptr_ioctl,
+};
+
+static const struct proc_ops uart_rx_proc_ops = {
+    .proc_open = uart_rx_open,
+    .proc_release = uart_rx_release,
+    .proc_read_iter = uart_proc_read_iter,
+    .proc_ioctl = uart_rx_ioctl,
+    .proc_compat_ioctl = uart_rx_compat_ioctl,
+};
+
+static const struct proc_ops uart_config_proc_ops = {
+    .proc_read = uart_config_read,
+    .proc_write = uart_config_write,
+};
+
+static const struct proc_ops uart_status_proc_ops = {
+    .proc_read = uart_status_read,
+};
+
+static const struct proc_ops uart_capture_proc_ops = {
+    .proc_read = uart_capture_read,
+};
+
+static const struct proc_ops uart_flight_proc_ops = {
+    .proc_read = uart_flight_read,
+};
+
+static const struct proc_ops uart_io_proc_ops = {
+    .proc_open = uart_io_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+};
+
+static const struct proc_ops uart_latency_proc_ops = {
+    .proc_read = uart_latency_read,
+};
+
+static const struct proc_ops uart_stats_proc_ops = {
+    .proc_read = uart_stats_read,
+};
+
+// ---------------------------------------------------------------------------
+// configfs interface (/sys/kernel/config/rpi2_uart/mu0)
+//
+// Each setting is a typed attribute that only stages a value; reading an
+// attribute shows the staged value, or the live one if none was written.
+// Writing 1 to "commit" lays the staged attributes over the live state,
+// checks the result as a whole and applies it under uart_cfg_mutex, which
+// /proc/uart_config also takes. Attributes not written are left as they
+// are, and a commit that fails part way restores the previous settings.
+// Writing 0 drops staged changes. The auto-response table, capture and
+// the one-shot actions (clear_fifo, reset_stats) stay on
+// /proc/uart_config. The layout has a directory per instance, but the
+// BCM2711 has a single mini UART, so mu0 is a fixed default group and
+// mkdir is refused.
+// ---------------------------------------------------------------------------
+
+#define UART_FRAMING_RAW   0
+#define UART_FRAMING_LZ4   1
+#define UART_FRAMING_SLIP  2
+
+static const char * const uart_framing_names[] = { "raw", "lz4", "slip" };
+static const char * const uart_bert_names[] = { "off", "prbs7", "prbs15", "prbs23" };
+
+// Attributes written since the last commit
+enum {
+    UART_CFG_BAUD,
+    UART_CFG_DATA_BITS,
+    UART_CFG_RX_MODE,
+    UART_CFG_FRAMING,
+    UART_CFG_ECHO,
+    UART_CFG_HISTORY_KB,
+    UART_CFG_HISTORY_SEC,
+    UART_CFG_SVC_IDLE_CHARS,
+    UART_CFG_ADDR_FILTER,
+    UART_CFG_ADDR_OFFSET,
+    UART_CFG_ADDR_BROADCAST,
+    UART_CFG_ADDR_GAP,
+    UART_CFG_BERT_TX,
+    UART_CFG_BERT_RX,
+};
+
+struct uart_cfg_stage {
+    u32 baudrate;
+    u32 data_bits;       // 7 or 8
+    bool rx_service;
+    u32 framing;         // UART_FRAMING_*
+    bool echo;
+    u32 history_kb;
+    u32 history_sec;
+    u32 svc_idle_chars;
+    bool addr_filter;
+    u8 addr_list[UART_ADDR_MAX];
+    u32 addr_count;
+    u32 addr_offset;
+    u32 addr_broadcast;  // UART_ADDR_NONE for none
+    u32 addr_gap;
+    u32 bert_tx;         // PRBS order, 0 when off
+    u32 bert_rx;
+};
+
+static struct uart_cfg_stage cfg_stage;
+static u32 cfg_dirty;    // BIT(UART_CFG_*) for each staged attribute
+static u32 cfg_commits;
+
+// Fill a stage from the running configuration
+static void uart_cfg_load(struct uart_cfg_stage *s)
+{
+    s->baudrate = config.baudrate;
+    s->data_bits = (config.data_bits == DATA_BITS_8) ? 8 : 7;
+    s->rx_service = rx_service_mode;
+    if (rcu_access_pointer(uart_net_dev)) {
+        s->framing = UART_FRAMING_SLIP;
+    } else if (compress_mode) {
+        s->framing = UART_FRAMING_LZ4;
+    } else {
+        s->framing = UART_FRAMING_RAW;
+    }
+    s->echo = echo_mode;
+    s->history_kb = rx_history_bytes / 1024;
+    s->history_sec = rx_history_sec;
+    s->svc_idle_chars = svc_idle_chars;
+    s->addr_filter = addr_filter_mode;
+    memcpy(s->addr_list, addr_list, sizeof(s->addr_list));
+    s->addr_count = addr_count;
+    s->addr_offset = addr_offset;
+    s->addr_broadcast = addr_broadcast;
+    s->addr_gap = addr_gap_chars;
+    s->bert_tx = READ_ONCE(bert_gen.order);
+    s->bert_rx = READ_ONCE(bert_chk.order);
+}
+
+// The live configuration with the staged attributes laid over it, so a
+// commit only changes what was written through configfs. Caller holds
+// uart_cfg_mutex.
+static void uart_cfg_view(struct uart_cfg_stage *s)
+{
+    uart_cfg_load(s);
+    
+    if (cfg_dirty & BIT(UART_CFG_BAUD)) {
+        s->baudrate = cfg_stage.baudrate;
+    }
+    if (cfg_dirty & BIT(UART_CFG_DATA_BITS)) {
+        s->data_bits = cfg_stage.data_bits;
+    }
+    if (cfg_dirty & BIT(UART_CFG_RX_MODE)) {
+        s->rx_service = cfg_stage.rx_service;
+    }
+    if (cfg_dirty & BIT(UART_CFG_FRAMING)) {
+        s->framing = cfg_stage.framing;
+    }
+    if (cfg_dirty & BIT(UART_CFG_ECHO)) {
+        s->echo = cfg_stage.echo;
+    }
+    if (cfg_dirty & BIT(UART_CFG_HISTORY_KB)) {
+        s->history_kb = cfg_stage.history_kb;
+    }
+    if (cfg_dirty & BIT(UART_CFG_HISTORY_SEC)) {
+        s->history_sec = cfg_stage.history_sec;
+    }
+    if (cfg_dirty & BIT(UART_CFG_SVC_IDLE_CHARS)) {
+        s->svc_idle_chars = cfg_stage.svc_idle_chars;
+    }
+    if (cfg_dirty & BIT(UART_CFG_ADDR_FILTER)) {
+        s->addr_filter = cfg_stage.addr_filter;
+        memcpy(s->addr_list, cfg_stage.addr_list, sizeof(s->addr_list));
+        s->addr_count = cfg_stage.addr_count;
+    }
+    if (cfg_dirty & BIT(UART_CFG_ADDR_OFFSET)) {
+        s->addr_offset = cfg_stage.addr_offset;
+    }
+    if (cfg_dirty & BIT(UART_CFG_ADDR_BROADCAST)) {
+        s->addr_broadcast = cfg_stage.addr_broadcast;
+    }
+    if (cfg_dirty & BIT(UART_CFG_ADDR_GAP)) {
+        s->addr_gap = cfg_stage.addr_gap;
+    }
+    if (cfg_dirty & BIT(UART_CFG_BERT_TX)) {
+        s->bert_tx = cfg_stage.bert_tx;
+    }
+    if (cfg_dirty & BIT(UART_CFG_BERT_RX)) {
+        s->bert_rx = cfg_stage.bert_rx;
+    }
+}
+
+// Check the staged set as a whole; single values are checked on store
+static int uart_cfg_validate(const struct uart_cfg_stage *s)
+{
+    if (!s->rx_service && (s->framing != UART_FRAMING_RAW || s->echo ||
+                           s->addr_filter || s->bert_tx || s->bert_rx)) {
+        pr_err("configfs: framing, echo, addr_filter and bert need rx_mode=service\n");
+        return -EINVAL;
+    }
+    
+    return 0;
+}
+
+// Look up a BERT pattern by its PRBS order
+static void uart_cfg_bert(u32 order, struct uart_bert *b)
+{
+    u32 i;
+    
+    for (i = 0; i < ARRAY_SIZE(uart_bert_names); i++) {
+        uart_bert_parse(uart_bert_names[i], b);
+        if (b->order == order) {
+            return;
+        }
+    }
+    uart_bert_parse("off", b);
+}
+
+// Apply a validated set. Only the hardware reconfiguration or bringing up
+// a framing mode can still fail part way; the caller rolls back then.
+static int uart_cfg_apply(const struct uart_cfg_stage *s)
+{
+    u32 bits = (s->data_bits == 8) ? DATA_BITS_8 : DATA_BITS_7;
+    struct uart_bert b;
+    int ret;
+    
+    if (s->baudrate != config.baudrate || bits != config.data_bits) {
+        config.baudrate = s->baudrate;
+        config.data_bits = bits;
+        ret = uart_apply_config();
+        if (ret) {
+            return ret;
+        }
+    }
+    
+    // Take down what is going away before bringing anything up
+    if (s->framing != UART_FRAMING_SLIP) {
+        uart_set_net_mode(false);
+    }
+    if (s->framing != UART_FRAMING_LZ4) {
+        uart_set_compress_mode(false);
+    }
+    if (!s->echo) {
+        echo_mode = false;
+    }
+    if (!s->addr_filter) {
+        addr_filter_mode = false;
+    }
+    // Restarting a running tester would reset its counts
+    if (!s->bert_tx && bert_gen.order) {
+        uart_cfg_bert(0, &b);
+        uart_bert_set_tx(&b);
+    }
+    if (!s->bert_rx && READ_ONCE(bert_chk.order)) {
+        uart_cfg_bert(0, &b);
+        uart_bert_set_rx(&b);
+    }
+    
+    rx_history_bytes = s->history_kb * 1024;
+    rx_history_sec = s->history_sec;
+    WRITE_ONCE(svc_idle_chars, s->svc_idle_chars);
+    addr_offset = s->addr_offset;
+    addr_broadcast = s->addr_broadcast;
+    addr_gap_chars = s->addr_gap;
+    
+    if (!s->rx_service) {
+        uart_set_rx_service_mode(false);
+        return 0;
+    }
+    
+    ret = uart_set_rx_service_mode(true);
+    if (ret) {
+        return ret;
+    }
+    if (s->framing == UART_FRAMING_LZ4) {
+        ret = uart_set_compress_mode(true);
+        if (ret) {
+            return ret;
+        }
+    } else if (s->framing == UART_FRAMING_SLIP) {
+        ret = uart_set_net_mode(true);
+        if (ret) {
+            return ret;
+        }
+    }
+    echo_mode = s->echo;
+    
+    if (s->addr_filter && (!addr_filter_mode || s->addr_count != addr_count ||
+                           memcmp(s->addr_list, addr_list, s->addr_count))) {
+        uart_addr_set(s->addr_list, s->addr_count);
+        addr_filter_mode = true;
+    }
+    if (s->bert_tx && s->bert_tx != bert_gen.order) {
+        uart_cfg_bert(s->bert_tx, &b);
+        uart_bert_set_tx(&b);
+    }
+    if (s->bert_rx && s->bert_rx != READ_ONCE(bert_chk.order)) {
+        uart_cfg_bert(s->bert_rx, &b);
+        uart_bert_set_rx(&b);
+    }
+    
+    return 0;
+}
+
+// Current view of the settings for the show handlers
+static void uart_cfg_snapshot(struct uart_cfg_stage *s)
+{
+    mutex_lock(&uart_cfg_mutex);
+    uart_cfg_view(s);
+    mutex_unlock(&uart_cfg_mutex);
+}
+
+// Stage one value; caller holds uart_cfg_mutex
+static void uart_cfg_stage_u32(u32 *field, u32 value, u32 attr)
+{
+    *field = value;
+    cfg_dirty |= BIT(attr);
+}
+
+static ssize_t uart_cfg_store_u32(const char *page, size_t count, u32 *field,
+                                  u32 attr, u32 min, u32 max)
+{
+    u32 value;
+    
+    if (kstrtou32(page, 0, &value) || value < min || value > max) {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&uart_cfg_mutex);
+    uart_cfg_stage_u32(field, value, attr);
+    mutex_unlock(&uart_cfg_mutex);
+    return count;
+}
+
+static ssize_t uart_cfg_store_bool(const char *page, size_t count, bool *field,
+                                   u32 attr)
+{
+    bool value;
+    
+    if (kstrtobool(page, &value)) {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&uart_cfg_mutex);
+    *field = value;
+    cfg_dirty |= BIT(attr);
+    mutex_unlock(&uart_cfg_mutex);
+    return count;
+}
+
+static ssize_t uart_cfg_baud_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.baudrate);
+}
+
+static ssize_t uart_cfg_baud_store(struct config_item *item, const char *page,
+                                   size_t count)
+{
+    u32 value;
+    
+    if (kstrtou32(page, 0, &value) || !uart_baud_supported(value)) {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&uart_cfg_mutex);
+    uart_cfg_stage_u32(&cfg_stage.baudrate, value, UART_CFG_BAUD);
+    mutex_unlock(&uart_cfg_mutex);
+    return count;
+}
+
+static ssize_t uart_cfg_data_bits_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.data_bits);
+}
+
+static ssize_t uart_cfg_data_bits_store(struct config_item *item,
+                                        const char *page, size_t count)
+{
+    return uart_cfg_store_u32(page, count, &cfg_stage.data_bits,
+                              UART_CFG_DATA_BITS, 7, 8);
+}
+
+static ssize_t uart_cfg_rx_mode_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%s\n", s.rx_service ? "service" : "poll");
+}
+
+static ssize_t uart_cfg_rx_mode_store(struct config_item *item,
+                                      const char *page, size_t count)
+{
+    bool service;
+    
+    if (sysfs_streq(page, "service")) {
+        service = true;
+    } else if (sysfs_streq(page, "poll")) {
+        service = false;
+    } else {
+        return -EINVAL;
+    }
+    
+    mutex_lock(&uart_cfg_mutex);
+    cfg_stage.rx_service = service;
+    cfg_dirty |= BIT(UART_CFG_RX_MODE);
+    mutex_unlock(&uart_cfg_mutex);
+    return count;
+}
+
+static ssize_t uart_cfg_framing_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%s\n", uart_framing_names[s.framing]);
+}
+
+static ssize_t uart_cfg_framing_store(struct config_item *item,
+                                      const char *page, size_t count)
+{
+    u32 i;
+    
+    for (i = 0; i < ARRAY_SIZE(uart_framing_names); i++) {
+        if (sysfs_streq(page, uart_framing_names[i])) {
+            mutex_lock(&uart_cfg_mutex);
+            uart_cfg_stage_u32(&cfg_stage.framing, i, UART_CFG_FRAMING);
+            mutex_unlock(&uart_cfg_mutex);
+            return count;
+        }
+    }
+    return -EINVAL;
+}
+
+static ssize_t uart_cfg_echo_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%d\n", s.echo);
+}
+
+static ssize_t uart_cfg_echo_store(struct config_item *item, const char *page,
+                                   size_t count)
+{
+    return uart_cfg_store_bool(page, count, &cfg_stage.echo, UART_CFG_ECHO);
+}
+
+static ssize_t uart_cfg_history_kb_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.history_kb);
+}
+
+static ssize_t uart_cfg_history_kb_store(struct config_item *item,
+                                         const char *page, size_t count)
+{
+    return uart_cfg_store_u32(page, count, &cfg_stage.history_kb,
+                              UART_CFG_HISTORY_KB, 1, UART_RX_BUF_SIZE / 1024);
+}
+
+static ssize_t uart_cfg_history_sec_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.history_sec);
+}
+
+static ssize_t uart_cfg_history_sec_store(struct config_item *item,
+                                          const char *page, size_t count)
+{
+    return uart_cfg_store_u32(page, count, &cfg_stage.history_sec,
+                              UART_CFG_HISTORY_SEC, 0, U32_MAX);
+}
+
+static ssize_t uart_cfg_svc_idle_chars_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.svc_idle_chars);
+}
+
+static ssize_t uart_cfg_svc_idle_chars_store(struct config_item *item,
+                                             const char *page, size_t count)
+{
+    return uart_cfg_store_u32(page, count, &cfg_stage.svc_idle_chars,
+                              UART_CFG_SVC_IDLE_CHARS, UART_FIFO_DEPTH / 2, 1024);
+}
+
+// "off" or the accepted addresses, comma separated
+static ssize_t uart_cfg_addr_filter_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    int len = 0;
+    u32 i;
     
-    if (copy_from_user(kbuf, buf, len)) {
-        return -EFAULT;
+    uart_cfg_snapshot(&s);
+    if (!s.addr_filter) {
+        return sprintf(page, "off\n");
     }
     
-    kbuf[len] = '\0';
+    for (i = 0; i < s.addr_count; i++) {
+        len += sprintf(page + len, "%s0x%02x", i ? "," : "", s.addr_list[i]);
+    }
+    len += sprintf(page + len, "\n");
+    return len;
+}
+
+static ssize_t uart_cfg_addr_filter_store(struct config_item *item,
+                                          const char *page, size_t count)
+{
+    u8 addrs[UART_ADDR_MAX];
+    char *list, *buf;
+    u32 n = 0;
+    bool on;
     
-    // Parse baud rate command
-    if (sscanf(kbuf, "baud=%u", &new_baud) == 1) {
-        // Validate baud rate
-        if (new_baud != BAUD_9600 && new_baud != BAUD_19200 &&
-            new_baud != BAUD_38400 && new_baud != BAUD_57600 &&
-            new_baud != BAUD_115200) {
-            pr_err("Unsupported baud rate: %u\n", new_baud);
-            return -EINVAL;
+    on = !sysfs_streq(page, "off");
+    if (on) {
+        buf = kstrndup(page, count, GFP_KERNEL);
+        if (!buf) {
+            return -ENOMEM;
         }
-        
-        config.baudrate = new_baud;
-        if (uart_apply_config() != 0) {
-            pr_err("Failed to apply baud rate configuration\n");
+        list = strim(buf);
+        if (uart_addr_parse(list, addrs, &n) != 0) {
+            kfree(buf);
             return -EINVAL;
         }
-        
-        pr_info("Baud rate changed to %u\n", new_baud);
+        kfree(buf);
     }
-    // Parse data bits command
-    else if (strncmp(kbuf, "bits=8", 6) == 0) {
-        config.data_bits = DATA_BITS_8;
-        if (uart_apply_config() != 0) {
-            return -EINVAL;
-        }
-        pr_info("Data bits changed to 8\n");
+    
+    mutex_lock(&uart_cfg_mutex);
+    cfg_stage.addr_filter = on;
+    memcpy(cfg_stage.addr_list, addrs, n);
+    cfg_stage.addr_count = n;
+    cfg_dirty |= BIT(UART_CFG_ADDR_FILTER);
+    mutex_unlock(&uart_cfg_mutex);
+    return count;
+}
+
+static ssize_t uart_cfg_addr_offset_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.addr_offset);
+}
+
+static ssize_t uart_cfg_addr_offset_store(struct config_item *item,
+                                          const char *page, size_t count)
+{
+    return uart_cfg_store_u32(page, count, &cfg_stage.addr_offset,
+                              UART_CFG_ADDR_OFFSET, 0, UART_ADDR_FRAME_MAX - 1);
+}
+
+// An address, or "none"
+static ssize_t uart_cfg_addr_broadcast_show(struct config_item *item,
+                                            char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    if (s.addr_broadcast == UART_ADDR_NONE) {
+        return sprintf(page, "none\n");
     }
-    else if (strncmp(kbuf, "bits=7", 6) == 0) {
-        config.data_bits = DATA_BITS_7;
-        if (uart_apply_config() != 0) {
-            return -EINVAL;
-        }
-        pr_info("Data bits changed to 7\n");
+    return sprintf(page, "0x%02x\n", s.addr_broadcast);
+}
+
+static ssize_t uart_cfg_addr_broadcast_store(struct config_item *item,
+                                             const char *page, size_t count)
+{
+    if (sysfs_streq(page, "none")) {
+        mutex_lock(&uart_cfg_mutex);
+        uart_cfg_stage_u32(&cfg_stage.addr_broadcast, UART_ADDR_NONE,
+                           UART_CFG_ADDR_BROADCAST);
+        mutex_unlock(&uart_cfg_mutex);
+        return count;
     }
-    // Clear FIFO command
-    else if (strncmp(kbuf, "clear_fifo", 10) == 0) {
-        uart_clear_fifos();
-        pr_info("FIFOs cleared\n");
+    return uart_cfg_store_u32(page, count, &cfg_stage.addr_broadcast,
+                              UART_CFG_ADDR_BROADCAST, 0, 0xFF);
+}
+
+static ssize_t uart_cfg_addr_gap_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return sprintf(page, "%u\n", s.addr_gap);
+}
+
+static ssize_t uart_cfg_addr_gap_store(struct config_item *item,
+                                       const char *page, size_t count)
+{
+    return uart_cfg_store_u32(page, count, &cfg_stage.addr_gap,
+                              UART_CFG_ADDR_GAP, UART_ADDR_GAP_MIN, U32_MAX);
+}
+
+static ssize_t uart_cfg_bert_show(u32 order, char *page)
+{
+    struct uart_bert b;
+    u32 i;
+    
+    for (i = 0; i < ARRAY_SIZE(uart_bert_names); i++) {
+        uart_bert_parse(uart_bert_names[i], &b);
+        if (b.order == order) {
+            return sprintf(page, "%s\n", uart_bert_names[i]);
+        }
     }
-    // Reset statistics
-    else if (strncmp(kbuf, "reset_stats", 11) == 0) {
-        memset(&stats, 0, sizeof(stats));
-        pr_info("Statistics reset\n");
+    return sprintf(page, "off\n");
+}
+
+static ssize_t uart_cfg_bert_store(const char *page, size_t count, u32 *field,
+                                   u32 attr)
+{
+    struct uart_bert b;
+    u32 i;
+    
+    for (i = 0; i < ARRAY_SIZE(uart_bert_names); i++) {
+        if (sysfs_streq(page, uart_bert_names[i])) {
+            uart_bert_parse(uart_bert_names[i], &b);
+            mutex_lock(&uart_cfg_mutex);
+            uart_cfg_stage_u32(field, b.order, attr);
+            mutex_unlock(&uart_cfg_mutex);
+            return count;
+        }
     }
-    else {
-        pr_err("Invalid command. Use: baud=<rate>, bits=<7|8>, clear_fifo, or reset_stats\n");
+    return -EINVAL;
+}
+
+static ssize_t uart_cfg_bert_tx_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return uart_cfg_bert_show(s.bert_tx, page);
+}
+
+static ssize_t uart_cfg_bert_tx_store(struct config_item *item,
+                                      const char *page, size_t count)
+{
+    return uart_cfg_bert_store(page, count, &cfg_stage.bert_tx, UART_CFG_BERT_TX);
+}
+
+static ssize_t uart_cfg_bert_rx_show(struct config_item *item, char *page)
+{
+    struct uart_cfg_stage s;
+    
+    uart_cfg_snapshot(&s);
+    return uart_cfg_bert_show(s.bert_rx, page);
+}
+
+static ssize_t uart_cfg_bert_rx_store(struct config_item *item,
+                                      const char *page, size_t count)
+{
+    return uart_cfg_bert_store(page, count, &cfg_stage.bert_rx, UART_CFG_BERT_RX);
+}
+
+// Reads back the number of successful commits
+static ssize_t uart_cfg_commit_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%u\n", cfg_commits);
+}
+
+static ssize_t uart_cfg_commit_store(struct config_item *item,
+                                     const char *page, size_t count)
+{
+    struct uart_cfg_stage s, old;
+    bool apply;
+    int ret = 0;
+    
+    if (kstrtobool(page, &apply)) {
         return -EINVAL;
     }
     
+    mutex_lock(&uart_cfg_mutex);
+    if (apply) {
+        uart_cfg_view(&s);
+        ret = uart_cfg_validate(&s);
+        if (ret) {
+            // Nothing changed; leave the staged set for correction
+            mutex_unlock(&uart_cfg_mutex);
+            return ret;
+        }
+        
+        uart_cfg_load(&old);
+        ret = uart_cfg_apply(&s);
+        if (ret) {
+            // Put back what was live, keeping the staged set for a retry
+            pr_err("configfs: commit failed (%d), restoring previous settings\n",
+                   ret);
+            uart_cfg_apply(&old);
+            mutex_unlock(&uart_cfg_mutex);
+            return ret;
+        }
+        cfg_commits++;
+        pr_info("configfs: committed configuration %u\n", cfg_commits);
+    }
+    cfg_dirty = 0;
+    mutex_unlock(&uart_cfg_mutex);
+    
     return count;
 }
 
-// Status read handler
-static ssize_t uart_status_read(struct file *file, char __user *buf,
-                                size_t count, loff_t *ppos)
+CONFIGFS_ATTR(uart_cfg_, baud);
+CONFIGFS_ATTR(uart_cfg_, data_bits);
+CONFIGFS_ATTR(uart_cfg_, rx_mode);
+CONFIGFS_ATTR(uart_cfg_, framing);
+CONFIGFS_ATTR(uart_cfg_, echo);
+CONFIGFS_ATTR(uart_cfg_, history_kb);
+CONFIGFS_ATTR(uart_cfg_, history_sec);
+CONFIGFS_ATTR(uart_cfg_, svc_idle_chars);
+CONFIGFS_ATTR(uart_cfg_, addr_filter);
+CONFIGFS_ATTR(uart_cfg_, addr_offset);
+CONFIGFS_ATTR(uart_cfg_, addr_broadcast);
+CONFIGFS_ATTR(uart_cfg_, addr_gap);
+CONFIGFS_ATTR(uart_cfg_, bert_tx);
+CONFIGFS_ATTR(uart_cfg_, bert_rx);
+CONFIGFS_ATTR(uart_cfg_, commit);
+
+static struct configfs_attribute *uart_cfg_attrs[] = {
+    &uart_cfg_attr_baud,
+    &uart_cfg_attr_data_bits,
+    &uart_cfg_attr_rx_mode,
+    &uart_cfg_attr_framing,
+    &uart_cfg_attr_echo,
+    &uart_cfg_attr_history_kb,
+    &uart_cfg_attr_history_sec,
+    &uart_cfg_attr_svc_idle_chars,
+    &uart_cfg_attr_addr_filter,
+    &uart_cfg_attr_addr_offset,
+    &uart_cfg_attr_addr_broadcast,
+    &uart_cfg_attr_addr_gap,
+    &uart_cfg_attr_bert_tx,
+    &uart_cfg_attr_bert_rx,
+    &uart_cfg_attr_commit,
+    NULL,
+};
+
+static const struct config_item_type uart_cfg_instance_type = {
+    .ct_attrs = uart_cfg_attrs,
+    .ct_owner = THIS_MODULE,
+};
+
+static const struct config_item_type uart_cfg_subsys_type = {
+    .ct_owner = THIS_MODULE,
+};
+
+static struct config_group uart_cfg_mu0;
+
+static struct configfs_subsystem uart_cfg_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = "rpi2_uart",
+            .ci_type = &uart_cfg_subsys_type,
+        },
+    },
+};
+
+static int uart_cfg_register(void)
 {
-    char kbuf[512];
-    int len;
-    u32 lsr, stat;
+    config_group_init(&uart_cfg_subsys.su_group);
+    mutex_init(&uart_cfg_subsys.su_mutex);
+    config_group_init_type_name(&uart_cfg_mu0, "mu0", &uart_cfg_instance_type);
+    configfs_add_default_group(&uart_cfg_mu0, &uart_cfg_subsys.su_group);
     
-    if (*ppos > 0) {
-        return 0;
+    return configfs_register_subsystem(&uart_cfg_subsys);
+}
+
+// ---------------------------------------------------------------------------
+// Live upgrade handover
+//
+// With handover_addr/handover_size pointing at a reserved memory region,
+// unloading parks the line configuration, statistics, RX mode and the
+// retained RX history there instead of saying goodbye on the line. The
+// next load adopts that state; if the mini UART registers still hold the
+// parked configuration it also skips GPIO/UART init, the FIFO clear and
+// the greeting, so bytes already in either FIFO survive the reload. State
+// is adopted once and only if it was parked recently during this boot:
+// the boottime clock restarts on reboot, so the parked block also carries
+// the kernel's random per-boot boot_id and must match it.
+// ---------------------------------------------------------------------------
+
+#define UART_HANDOVER_MAX_AGE_NS  (60 * NSEC_PER_SEC)
+#define UART_BOOT_ID_PATH         "/proc/sys/kernel/random/boot_id"
+
+static unsigned long handover_addr;
+module_param(handover_addr, ulong, 0444);
+MODULE_PARM_DESC(handover_addr, "Physical address of the reserved handover region");
+
+static unsigned long handover_size;
+module_param(handover_size, ulong, 0444);
+MODULE_PARM_DESC(handover_size, "Size of the handover region in bytes");
+
+static struct uart_handover *handover;
+static uuid_t uart_boot_id;
+
+// The kernel keeps boot_id private, so read it the way userspace does
+static int uart_handover_read_boot_id(uuid_t *id)
+{
+    char buf[UUID_STRING_LEN + 1];
+    struct file *file;
+    loff_t pos = 0;
+    ssize_t n;
+    
+    file = filp_open(UART_BOOT_ID_PATH, O_RDONLY, 0);
+    if (IS_ERR(file)) {
+        return PTR_ERR(file);
     }
+    n = kernel_read(file, buf, UUID_STRING_LEN, &pos);
+    filp_close(file, NULL);
+    if (n != UUID_STRING_LEN) {
+        return n < 0 ? n : -EIO;
+    }
+    buf[UUID_STRING_LEN] = '\0';
     
-    lsr = readl(&uart->MU_LSR);
-    stat = readl(&uart->MU_STAT);
+    return uuid_parse(buf, id);
+}
+
+static void uart_handover_map(void)
+{
+    int ret;
     
-    len = snprintf(kbuf, sizeof(kbuf),
-        "UART Status\n"
-        "===========\n"
-        "TX FIFO empty: %s\n"
-        "TX FIFO full: %s\n"
-        "RX FIFO has data: %s\n"
-        "RX FIFO overrun: %s\n"
-        "TX FIFO level: %u\n"
-        "RX FIFO level: %u\n",
-        (lsr & (1 << 5)) ? "Yes" : "No",
-        (stat & (1 << 9)) ? "Yes" : "No",
-        (lsr & (1 << 0)) ? "Yes" : "No",
-        (lsr & (1 << 1)) ? "Yes (ERROR!)" : "No",
-        (stat >> 24) & 0xF,
-        (stat >> 16) & 0xF);
+    if (!handover_addr || !handover_size) {
+        return;
+    }
     
-    if (len > count) {
-        len = count;
+    if (handover_size < sizeof(*handover)) {
+        pr_warn("Handover region needs %zu bytes, disabled\n", sizeof(*handover));
+        return;
     }
     
-    if (copy_to_user(buf, kbuf, len)) {
-        return -EFAULT;
+    ret = uart_handover_read_boot_id(&uart_boot_id);
+    if (ret) {
+        pr_warn("Cannot read boot_id (%d), handover disabled\n", ret);
+        return;
     }
     
-    *ppos += len;
-    return len;
+    handover = memremap(handover_addr, sizeof(*handover), MEMREMAP_WB);
+    if (!handover) {
+        pr_warn("Failed to map handover region, disabled\n");
+    }
 }
 
-// Statistics read handler
-static ssize_t uart_stats_read(struct file *file, char __user *buf,
-                               size_t count, loff_t *ppos)
+static void uart_handover_unmap(void)
 {
-    char kbuf[512];
-    int len;
-    
-    if (*ppos > 0) {
-        return 0;
+    if (handover) {
+        memunmap(handover);
+        handover = NULL;
     }
+}
+
+// Take over parked state if there is any. Returns true when adopted.
+static bool uart_handover_adopt(void)
+{
+    u64 now = ktime_get_boottime_ns();
     
-    len = snprintf(kbuf, sizeof(kbuf),
-        "UART Statistics\n"
-        "===============\n"
-        "TX bytes: %llu\n"
-        "RX bytes: %llu\n"
-        "TX errors: %llu\n"
-        "RX errors: %llu\n"
-        "FIFO overruns: %llu\n"
-        "\nTo reset: echo \"reset_stats\" > /proc/uart_config\n",
-        stats.tx_bytes,
-        stats.rx_bytes,
-        stats.tx_errors,
-        stats.rx_errors,
-        stats.fifo_overruns);
-    
-    if (len > count) {
-        len = count;
+    if (!handover || handover->magic != UART_HANDOVER_MAGIC ||
+        handover->size != sizeof(*handover)) {
+        return false;
     }
     
-    if (copy_to_user(buf, kbuf, len)) {
-        return -EFAULT;
+    // Never adopt twice, or across a reboot that kept the region
+    handover->magic = 0;
+    if (!uuid_equal(&handover->boot_id, &uart_boot_id) ||
+        handover->parked_ns > now ||
+        now - handover->parked_ns > UART_HANDOVER_MAX_AGE_NS ||
+        !uart_baud_supported(handover->config.baudrate) ||
+        (handover->config.data_bits != DATA_BITS_8 &&
+         handover->config.data_bits != DATA_BITS_7) ||
+        handover->rx_len > UART_HANDOVER_RX_MAX) {
+        return false;
     }
     
-    *ppos += len;
-    return len;
+    config = handover->config;
+    stats = handover->stats;
+    cost = handover->cost;
+    rx_history_bytes = handover->rx_history_bytes;
+    rx_history_sec = handover->rx_history_sec;
+    
+    pr_info("Adopted parked state: baud=%u, %u RX bytes\n",
+            config.baudrate, handover->rx_len);
+    return true;
 }
 
-// Proc operations
-static const struct proc_ops uart_tx_proc_ops = {
-    .proc_write = uart_proc_write,
-};
-
-static const struct proc_ops uart_rx_proc_ops = {
-    .proc_read = uart_proc_read,
-};
-
-static const struct proc_ops uart_config_proc_ops = {
-    .proc_read = uart_config_read,
-    .proc_write = uart_config_write,
-};
+// True if the mini UART is already running with the current config
+static bool uart_handover_hw_matches(void)
+{
+    u16 baud_reg;
+    
+    if (calculate_baud_register(config.baudrate, &baud_reg) != 0) {
+        return false;
+    }
+    
+    return (readl(&uart->ENABLES) & 0x1) &&
+           (readl(&uart->MU_CNTL) & 0x3) == 0x3 &&
+           (readl(&uart->MU_LCR) & 0x3) == config.data_bits &&
+           (readl(&uart->MU_BAUD) & 0xFFFF) == baud_reg;
+}
 
-static const struct proc_ops uart_status_proc_ops = {
-    .proc_read = uart_status_read,
-};
+// Bring back the RX mode and history once the proc files exist
+static void uart_handover_resume(void)
+{
+    if (handover->rx_service_mode && uart_set_rx_service_mode(true) != 0) {
+        pr_warn("Handover: failed to restart RX service mode\n");
+    }
+    if (handover->rx_len) {
+        uart_rx_ring_put(handover->rx, handover->rx_len);
+    }
+}
 
-static const struct proc_ops uart_stats_proc_ops = {
-    .proc_read = uart_stats_read,
-};
+// Park state for the next load. Called once the service thread is gone.
+static bool uart_handover_park(bool service_mode)
+{
+    u64 start, pos;
+    size_t off, first;
+    u32 len;
+    
+    if (!handover) {
+        return false;
+    }
+    
+    handover->magic = 0;
+    handover->size = sizeof(*handover);
+    handover->config = config;
+    handover->stats = stats;
+    handover->cost = cost;
+    handover->rx_service_mode = service_mode;
+    handover->rx_history_bytes = rx_history_bytes;
+    handover->rx_history_sec = rx_history_sec;
+    
+    // Newest retained history, as much as fits
+    spin_lock(&uart_rx_lock);
+    start = uart_rx_history_start();
+    pos = max_t(u64, start, rx_head > UART_HANDOVER_RX_MAX ?
+                            rx_head - UART_HANDOVER_RX_MAX : 0);
+    len = rx_head - pos;
+    off = pos & (UART_RX_BUF_SIZE - 1);
+    first = min_t(size_t, len, UART_RX_BUF_SIZE - off);
+    memcpy(handover->rx, uart_rx_ring + off, first);
+    memcpy(handover->rx + first, uart_rx_ring, len - first);
+    spin_unlock(&uart_rx_lock);
+    handover->rx_len = len;
+    
+    handover->parked_ns = ktime_get_boottime_ns();
+    uuid_copy(&handover->boot_id, &uart_boot_id);
+    wmb();
+    handover->magic = UART_HANDOVER_MAGIC;
+    
+    pr_info("Parked state for handover: %u RX bytes\n", len);
+    return true;
+}
 
 // Module initialization 
 static int __init uart_driver_init(void)
 {
+    bool adopted;
     int ret;
     
     // Map GPIO registers 
@@ -567,16 +6158,29 @@ static int __init uart_driver_init(void)
         return -ENOMEM;
     }
     
-    // Initialize GPIO
-    uart_init_gpio();
+    // Map the flight recorder before any traffic
+    uart_flight_init();
     
-    // Initialize UART hardware
-    ret = uart_init_hardware();
-    if (ret != 0) {
-        pr_err("Failed to initialize UART hardware\n");
-        iounmap(uart);
-        iounmap(gpio);
-        return ret;
+    // Take over from a previous instance if it parked its state
+    uart_handover_map();
+    adopted = uart_handover_adopt();
+    
+    if (adopted && uart_handover_hw_matches()) {
+        pr_info("Mini UART already configured, skipping hardware init\n");
+    } else {
+        // Initialize GPIO
+        uart_init_gpio();
+        
+        // Initialize UART hardware
+        ret = uart_init_hardware();
+        if (ret != 0) {
+            pr_err("Failed to initialize UART hardware\n");
+            uart_handover_unmap();
+            uart_flight_exit();
+            iounmap(uart);
+            iounmap(gpio);
+            return ret;
+        }
     }
     
     // Create /proc/uart_tx
@@ -614,8 +6218,52 @@ static int __init uart_driver_init(void)
         goto cleanup_status;
     }
     
-    // Send test message
-    uart_send_string("Mini UART driver loaded successfully!\r\n");
+    // Create /proc/uart_capture
+    proc_capture = proc_create(PROC_UART_CAPTURE, 0444, NULL, &uart_capture_proc_ops);
+    if (!proc_capture) {
+        pr_err("Failed to create /proc/%s\n", PROC_UART_CAPTURE);
+        goto cleanup_stats;
+    }
+    
+    // Create /proc/uart_flight
+    proc_flight = proc_create(PROC_UART_FLIGHT, 0444, NULL, &uart_flight_proc_ops);
+    if (!proc_flight) {
+        pr_err("Failed to create /proc/%s\n", PROC_UART_FLIGHT);
+        goto cleanup_capture;
+    }
+    
+    // Create /proc/uart_io
+    proc_io = proc_create(PROC_UART_IO, 0444, NULL, &uart_io_proc_ops);
+    if (!proc_io) {
+        pr_err("Failed to create /proc/%s\n", PROC_UART_IO);
+        goto cleanup_flight;
+    }
+    
+    // Create /proc/uart_latency
+    proc_latency = proc_create(PROC_UART_LATENCY, 0444, NULL,
+                               &uart_latency_proc_ops);
+    if (!proc_latency) {
+        pr_err("Failed to create /proc/%s\n", PROC_UART_LATENCY);
+        goto cleanup_io;
+    }
+    
+    // Register /sys/kernel/config/rpi2_uart
+    ret = uart_cfg_register();
+    if (ret) {
+        pr_err("Failed to register configfs subsystem\n");
+        goto cleanup_latency;
+    }
+    
+    if (console_enable) {
+        register_console(&uart_console);
+    }
+    
+    // Send test message, unless the link is being handed over
+    if (adopted) {
+        uart_handover_resume();
+    } else {
+        uart_send_string("Mini UART driver loaded successfully!\r\n");
+    }
     
     pr_info("===========================================\n");
     pr_info("UART driver loaded successfully\n");
@@ -625,10 +6273,25 @@ static int __init uart_driver_init(void)
     pr_info("  /proc/%s - Read/write configuration\n", PROC_UART_CONFIG);
     pr_info("  /proc/%s - Read current status\n", PROC_UART_STATUS);
     pr_info("  /proc/%s - Read statistics\n", PROC_UART_STATS);
+    pr_info("  /proc/%s - Read frozen capture window\n", PROC_UART_CAPTURE);
+    pr_info("  /proc/%s - Read previous boot's flight recorder\n", PROC_UART_FLIGHT);
+    pr_info("  /proc/%s - Read per-file and per-process I/O\n", PROC_UART_IO);
+    pr_info("  /proc/%s - Read RX delivery latency\n", PROC_UART_LATENCY);
+    pr_info("  /sys/kernel/config/rpi2_uart/mu0 - Staged configuration\n");
     pr_info("===========================================\n");
     
     return 0;
 
+cleanup_latency:
+    proc_remove(proc_latency);
+cleanup_io:
+    proc_remove(proc_io);
+cleanup_flight:
+    proc_remove(proc_flight);
+cleanup_capture:
+    proc_remove(proc_capture);
+cleanup_stats:
+    proc_remove(proc_stats);
 cleanup_status:
     proc_remove(proc_status);
 cleanup_config:
@@ -638,6 +6301,8 @@ cleanup_rx:
 cleanup_tx:
     proc_remove(proc_tx);
 cleanup_uart:
+    uart_handover_unmap();
+    uart_flight_exit();
     iounmap(uart);
     iounmap(gpio);
     return -ENOMEM;
@@ -646,15 +6311,40 @@ cleanup_uart:
 // Module cleanup
 static void __exit uart_driver_exit(void)
 {
-    uart_send_string("Mini UART driver unloading...\r\n");
+    bool service_mode = rx_service_mode;
+    
+    configfs_unregister_subsystem(&uart_cfg_subsys);
+    
+    if (console_enable) {
+        unregister_console(&uart_console);
+        cancel_work_sync(&uart_con_work);
+    }
+    
+    uart_periodic_stop();
+    uart_set_net_mode(false);
+    uart_set_compress_mode(false);
+    uart_set_rx_service_mode(false);
+    uart_rx_filter_set(NULL);
+    kfree_skb(uart_filter_skb);
+    if (!uart_handover_park(service_mode)) {
+        uart_send_string("Mini UART driver unloading...\r\n");
+    }
+    uart_handover_unmap();
     
     // Remove all proc entries
+    proc_remove(proc_latency);
+    proc_remove(proc_io);
+    proc_remove(proc_flight);
+    proc_remove(proc_capture);
     proc_remove(proc_stats);
     proc_remove(proc_status);
     proc_remove(proc_config);
     proc_remove(proc_rx);
     proc_remove(proc_tx);
     
+    uart_io_exit();
+    uart_flight_exit();
+    
     // Unmap registers
     if (uart)
         iounmap(uart);
@@ -2,13 +2,51 @@
 #define UART_DRIVER_H
 
 #include <linux/kernel.h>
+#include <linux/version.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
 #include <linux/uaccess.h>
 #include <linux/io.h>
 #include <linux/delay.h>
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
 #include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/math64.h>
+#include <linux/sched/clock.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/console.h>
+#include <linux/percpu.h>
+#include <linux/lz4.h>
+#include <linux/crc16.h>
+#include <linux/crc-itu-t.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/ioctl.h>
+#include <linux/sched/signal.h>
+#include <linux/filter.h>
+#include <linux/compat.h>
+#include <linux/skbuff.h>
+#include <linux/vmalloc.h>
+#include <linux/overflow.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
+#include <linux/timekeeping.h>
+#include <linux/uio.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/rtnetlink.h>
+#include <linux/hrtimer.h>
+#include <linux/completion.h>
+#include <linux/bits.h>
+#include <linux/configfs.h>
+#include <linux/seq_file.h>
+#include <linux/uuid.h>
 
 
 // Proc file names
@@ -17,6 +55,10 @@
 #define PROC_UART_CONFIG "uart_config"
 #define PROC_UART_STATUS "uart_status"
 #define PROC_UART_STATS  "uart_stats"
+#define PROC_UART_CAPTURE "uart_capture"
+#define PROC_UART_FLIGHT "uart_flight"
+#define PROC_UART_IO "uart_io"
+#define PROC_UART_LATENCY "uart_latency"
 
 // Base addresses for BCM2711 
 #define PERIPHERAL_BASE 0xFE000000UL
@@ -56,6 +98,9 @@ struct uart_regs {
     volatile u32 MU_BAUD;       /* 0x68 */
 };
 
+// Mini UART FIFO depth (both directions)
+#define UART_FIFO_DEPTH  8
+
 // GPIO register offsets 
 #define GPFSEL1    0x04
 #define GPPUD      0x94
@@ -69,6 +114,12 @@ struct uart_regs {
 #define BAUD_57600   57600
 #define BAUD_115200  115200
 
+// SLIP framing bytes (RFC 1055)
+#define SLIP_END      0xC0
+#define SLIP_ESC      0xDB
+#define SLIP_ESC_END  0xDC
+#define SLIP_ESC_ESC  0xDD
+
 // Data bits
 #define DATA_BITS_7  0x0
 #define DATA_BITS_8  0x3
@@ -87,6 +138,272 @@ struct uart_stats {
     u64 tx_errors;
     u64 rx_errors;
     u64 fifo_overruns;
+    u64 rx_buffer_drops;
+    u64 rx_filter_drops;
+    u64 rx_filter_truncated;
+    u64 addr_accepted;
+    u64 addr_filtered;
+    u64 ar_responses;
+    u64 ar_busy;
+    u64 tx_gaps;
+    u64 echo_bytes;
+    u64 echo_drops;
+    u64 bert_tx_bytes;
+    u64 bert_rx_bits;
+    u64 bert_bit_errors;
+    u64 bert_byte_errors;
+    u64 bert_resyncs;
+    u64 comp_tx_raw;
+    u64 comp_tx_wire;
+    u64 comp_rx_raw;
+    u64 comp_rx_wire;
+    u64 comp_rx_errors;
+};
+
+// CPU cost accounting (local_clock() ns). "time" is the whole span spent
+// inside a service path, "sleep" the part of it spent in usleep_range();
+// busy time is the difference.
+struct uart_cost {
+    u64 tx_time_ns;
+    u64 tx_sleep_ns;
+    u64 tx_bytes;       // sent by the polled TX path only
+    u64 rx_time_ns;
+    u64 rx_sleep_ns;
+    u64 rx_bytes;       // read by the polled RX path only
+    u64 svc_time_ns;
+    u64 svc_sleep_ns;
+    u64 svc_bytes;
+    u64 svc_wakeups;
+    u64 svc_idle_wakeups;
+    u64 comp_ns;
+    u64 decomp_ns;
+};
+
+// In-kernel client API
+//
+// One client at a time may own the UART. Opening a client starts the
+// service thread, which polls the RX FIFO and hands each burst to rx()
+// and feeds queued writes into the TX FIFO. Callbacks run in the service
+// thread and must not call rpi2_uart_close(); they may queue more writes.
+struct rpi2_uart_client;
+
+typedef void (*rpi2_uart_rx_cb)(struct rpi2_uart_client *client,
+                                const u8 *data, size_t len);
+typedef void (*rpi2_uart_tx_done_cb)(struct rpi2_uart_client *client,
+                                     void *ctx, int status);
+
+struct rpi2_uart_client {
+    rpi2_uart_rx_cb rx;
+    void *priv;
+};
+
+int rpi2_uart_open(struct rpi2_uart_client *client);
+void rpi2_uart_close(struct rpi2_uart_client *client);
+int rpi2_uart_write(struct rpi2_uart_client *client, const u8 *data,
+                    size_t len, rpi2_uart_tx_done_cb done, void *ctx);
+int rpi2_uart_set_baudrate(struct rpi2_uart_client *client, u32 baudrate);
+int rpi2_uart_set_data_bits(struct rpi2_uart_client *client, u32 bits);
+
+// ioctl interface on /proc/uart_tx
+#define UART_IOC_MAGIC 'u'
+
+// File transfer protocols
+#define UART_XFER_XMODEM    0  // 128-byte blocks
+#define UART_XFER_XMODEM1K  1  // 1024-byte blocks
+#define UART_XFER_YMODEM    2  // batch header + 1024-byte blocks
+
+// File transfer states
+#define UART_XFER_IDLE     0
+#define UART_XFER_WAITING  1
+#define UART_XFER_SENDING  2
+#define UART_XFER_DONE     3
+#define UART_XFER_FAILED   4
+
+struct uart_xfer_req {
+    __s32 fd;
+    __u32 protocol;
+};
+
+struct uart_xfer_status {
+    __u32 protocol;
+    __u32 state;
+    __u64 bytes;
+    __u64 total;
+    __u32 blocks;
+    __u32 retries;
+    __s32 result;
+    __u32 reserved;
+};
+
+#define UART_IOC_XFER_SEND   _IOW(UART_IOC_MAGIC, 1, struct uart_xfer_req)
+#define UART_IOC_XFER_STATUS _IOR(UART_IOC_MAGIC, 2, struct uart_xfer_status)
+
+// Send count bytes (0: to EOF) of fd from offset out of the UART. Returns
+// the bytes sent, which is short if a signal arrived mid-transfer.
+struct uart_tx_sendfile {
+    __s32 fd;
+    __u32 reserved;
+    __u64 offset;
+    __u64 count;
+};
+
+#define UART_IOC_TX_SENDFILE _IOW(UART_IOC_MAGIC, 3, struct uart_tx_sendfile)
+
+// Periodic TX job: resend a frame every period_us from an hrtimer,
+// optionally preceded by a line break and mark-after-break (DMX512)
+#define UART_PERIODIC_MAX  1024
+
+struct uart_periodic {
+    __u64 data;        // user pointer to the frame
+    __u32 len;
+    __u32 period_us;   // 0 on UPDATE keeps the running period
+    __u32 break_us;    // 0 for no break
+    __u32 mab_us;
+};
+
+struct uart_periodic_stats {
+    __u64 frames;
+    __u64 missed;        // periods skipped while a frame was still pending
+    __s64 jitter_min_ns; // frame start minus scheduled time
+    __s64 jitter_max_ns;
+    __u64 jitter_avg_ns; // mean absolute jitter
+    __u32 period_us;
+    __u32 len;
+};
+
+#define UART_IOC_PERIODIC_START  _IOW(UART_IOC_MAGIC, 4, struct uart_periodic)
+#define UART_IOC_PERIODIC_UPDATE _IOW(UART_IOC_MAGIC, 5, struct uart_periodic)
+#define UART_IOC_PERIODIC_STOP   _IO(UART_IOC_MAGIC, 6)
+#define UART_IOC_PERIODIC_STATS  _IOR(UART_IOC_MAGIC, 7, struct uart_periodic_stats)
+
+// Collect writes on this file until UNCORK, then send them as one
+// gap-free frame; UNCORK returns once the frame is in the TX FIFO
+#define UART_IOC_TX_CORK    _IO(UART_IOC_MAGIC, 8)
+#define UART_IOC_TX_UNCORK  _IO(UART_IOC_MAGIC, 9)
+
+// Capture record, as read from /proc/uart_capture
+struct uart_cap_record {
+    __u64 ts_ns;       // local_clock() timestamp
+    __u8 dir;          // UART_CAP_RX, UART_CAP_TX or UART_CAP_EVENT
+    __u8 data;         // byte on the wire, or UART_CAP_EV_* for events
+    __u8 trigger;      // set on the record that fired the trigger
+    __u8 reserved[5];
+};
+
+#define UART_CAP_RX     0
+#define UART_CAP_TX     1
+#define UART_CAP_EVENT  2
+
+#define UART_CAP_EV_OVERRUN   1
+#define UART_CAP_EV_TX_STALL  2
+
+// Flight recorder region layout: header followed by a power-of-two
+// number of records. Directions use the UART_CAP_RX/TX codes.
+#define UART_FLIGHT_MAGIC  0x52504946  // "RPIF"
+#define UART_FLIGHT_DATA   40
+
+struct uart_flight_hdr {
+    u32 magic;
+    u32 nrec;
+    atomic64_t head;   // records appended since load
 };
 
+struct uart_flight_record {
+    __u64 seq;         // 1-based append index, written last
+    __u64 ts_ns;       // local_clock() timestamp
+    __u16 len;
+    __u8 dir;
+    __u8 reserved[5];
+    __u8 data[UART_FLIGHT_DATA];
+};
+
+// State parked across a module reload (handover_addr region)
+#define UART_HANDOVER_MAGIC   0x52504948  // "RPIH"
+#define UART_HANDOVER_RX_MAX  16384
+
+struct uart_handover {
+    u32 magic;              // written last when parking
+    u32 size;               // sizeof(struct uart_handover) of the parker
+    u64 parked_ns;          // boottime clock
+    uuid_t boot_id;         // kernel boot_id of the parking boot
+    struct uart_config config;
+    struct uart_stats stats;
+    struct uart_cost cost;
+    u32 rx_service_mode;
+    u32 rx_history_bytes;
+    u32 rx_history_sec;
+    u32 rx_len;
+    u8 rx[UART_HANDOVER_RX_MAX];
+};
+
+// Capture trigger sources
+#define UART_CAP_TRIG_PATTERN   0x1
+#define UART_CAP_TRIG_OVERRUN   0x2
+#define UART_CAP_TRIG_TX_STALL  0x4
+
+// RX filter destinations: an attached classic BPF program returns 0 to
+// drop the burst or a mask of these to steer it. Any larger value, such
+// as the snapshot length a tcpdump-style filter returns, delivers it
+// everywhere. Bursts longer than the filter window are judged on their
+// first 512 bytes.
+#define UART_RX_TO_READER  0x1  // /proc/uart_rx buffer
+#define UART_RX_TO_CLIENT  0x2  // in-kernel client
+#define UART_RX_TO_ALL     (UART_RX_TO_READER | UART_RX_TO_CLIENT)
+
+// ioctl interface on /proc/uart_rx
+#define UART_IOC_ATTACH_FILTER  _IOW(UART_IOC_MAGIC, 16, struct sock_fprog)
+#define UART_IOC_DETACH_FILTER  _IO(UART_IOC_MAGIC, 17)
+
+// Where a /proc/uart_rx reader starts (rx_mode=service)
+#define UART_RX_SEEK_OLDEST  0  // oldest byte within the history window
+#define UART_RX_SEEK_NOW     1  // only new data (default on open)
+#define UART_RX_SEEK_TIME    2  // first burst at or after ts_ns
+
+struct uart_rx_seek {
+    __u32 whence;
+    __u32 reserved;
+    __u64 ts_ns;       // CLOCK_MONOTONIC, for UART_RX_SEEK_TIME
+    __u64 pos;         // out: new stream position
+    __u64 available;   // out: bytes now readable
+};
+
+#define UART_IOC_RX_SEEK  _IOWR(UART_IOC_MAGIC, 18, struct uart_rx_seek)
+
+// Per-file reader wakeup condition. With anything but UART_RX_WAKE_ANY,
+// read() waits for a complete message and never returns part of one that
+// has not fully arrived.
+#define UART_RX_WAKE_ANY     0  // any new data (default)
+#define UART_RX_WAKE_DELIM   1  // message ends with delim
+#define UART_RX_WAKE_LENGTH  2  // header carries a length field
+#define UART_RX_WAKE_FIXED   3  // every message is frame_size bytes
+
+struct uart_rx_wake {
+    __u32 mode;
+    __u8 delim;
+    __u8 len_offset;   // offset of the length field in the message
+    __u8 len_size;     // 1 or 2 bytes
+    __u8 len_be;       // nonzero for a big-endian field
+    __s32 len_adjust;  // message = len_offset + len_size + field + len_adjust
+    __u32 frame_size;
+};
+
+#define UART_IOC_RX_SET_WAKE  _IOW(UART_IOC_MAGIC, 19, struct uart_rx_wake)
+
+// RX record mode (rx_mode=service), enabled per file with
+// UART_IOC_RX_SET_RECORD (arg 1 on, 0 off). Each read() then returns one
+// header followed by len data bytes. flags say what happened in the stream
+// just before the first data byte, and a record never runs past the next
+// such point, so a protocol layer can resynchronise exactly there.
+#define UART_RX_REC_OVERRUN  (1 << 0)  // RX FIFO overrun lost bytes here
+#define UART_RX_REC_DROPPED  (1 << 1)  // this reader lost 'lost' bytes here
+
+struct uart_rx_rec {
+    __u16 flags;
+    __u16 len;     // data bytes following the header
+    __u32 lost;    // bytes skipped with UART_RX_REC_DROPPED
+    __u64 pos;     // stream offset of the first data byte
+};
+
+#define UART_IOC_RX_SET_RECORD  _IO(UART_IOC_MAGIC, 20)
+
 #endif
@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+"""Peer-driven RX latency measurement for the mini UART driver.
+
+Two halves, one per end of the link:
+
+  peer  runs on the machine wired to the Pi's UART. It sends one byte at
+        a time at known, jittered instants, so every sample starts from
+        an idle line and an empty RX FIFO.
+
+  dut   runs on the Pi. For each RX mode and baud rate it switches the
+        driver over, clears the statistics, keeps /proc/uart_rx drained
+        while the peer transmits, then prints /proc/uart_latency.
+
+Both ends have to be at the same baud rate, so they step through the same
+list in lockstep, spending the same fixed window on each rate: start "dut"
+first, then "peer" within --settle seconds, with the same --modes,
+--bauds, --count, --interval and --settle. The peer waits --settle
+seconds into each window before sending, while the DUT switches over.
+
+Example:
+  pi$    sudo ./uart_latency.py dut --modes poll,service
+  peer$  ./uart_latency.py peer /dev/ttyUSB0 --modes poll,service
+"""
+
+import argparse
+import os
+import random
+import select
+import sys
+import termios
+import time
+
+PROC = "/proc"
+BAUDS = [9600, 19200, 38400, 57600, 115200]
+TERMIOS_BAUD = {
+    9600: termios.B9600,
+    19200: termios.B19200,
+    38400: termios.B38400,
+    57600: termios.B57600,
+    115200: termios.B115200,
+}
+
+
+def proc_write(name, cmd):
+    with open(os.path.join(PROC, name), "w") as f:
+        f.write(cmd)
+
+
+def proc_read(name):
+    with open(os.path.join(PROC, name)) as f:
+        return f.read()
+
+
+def open_peer(dev, baud):
+    fd = os.open(dev, os.O_RDWR | os.O_NOCTTY)
+    attr = termios.tcgetattr(fd)
+    attr[0] = 0                                             # iflag
+    attr[1] = 0                                             # oflag
+    attr[2] = termios.CS8 | termios.CREAD | termios.CLOCAL  # cflag, 8N1
+    attr[3] = 0                                             # lflag
+    attr[4] = attr[5] = TERMIOS_BAUD[baud]
+    termios.tcsetattr(fd, termios.TCSANOW, attr)
+    termios.tcflush(fd, termios.TCIOFLUSH)
+    return fd
+
+
+def window(args):
+    # Room for the worst-case jitter plus a settle period at each end
+    return 2 * args.count * args.interval + 2 * args.settle
+
+
+def run_peer(args):
+    start = time.monotonic()
+    for mode in args.modes:
+        for baud in args.bauds:
+            time.sleep(args.settle)
+            fd = open_peer(args.device, baud)
+            print(f"peer: {mode} {baud} baud, {args.count} bytes", flush=True)
+            for i in range(args.count):
+                # Jitter keeps the sends from locking onto the driver's
+                # poll or service interval
+                time.sleep(args.interval * random.uniform(0.5, 1.5))
+                os.write(fd, bytes([0x41 + i % 26]))
+                termios.tcdrain(fd)
+            os.close(fd)
+            start += window(args)
+            time.sleep(max(0.0, start - time.monotonic()))
+
+
+def drain_rx(seconds):
+    fd = os.open(os.path.join(PROC, "uart_rx"), os.O_RDONLY | os.O_NONBLOCK)
+    end = time.monotonic() + seconds
+    got = 0
+    try:
+        while time.monotonic() < end:
+            select.select([fd], [], [], 0.1)
+            try:
+                got += len(os.read(fd, 4096))
+            except BlockingIOError:
+                pass
+    finally:
+        os.close(fd)
+    return got
+
+
+def run_dut(args):
+    start = time.monotonic()
+    for mode in args.modes:
+        for baud in args.bauds:
+            proc_write("uart_config", f"rx_mode={mode}")
+            proc_write("uart_config", f"baud={baud}")
+            proc_write("uart_config", "clear_fifo")
+            proc_write("uart_config", "reset_stats")
+            start += window(args)
+            got = drain_rx(start - time.monotonic())
+            print(f"dut: {mode} {baud} baud, received {got} of {args.count}")
+            for line in proc_read("uart_latency").splitlines():
+                if line.startswith(f"{mode} ") and f" {baud} " in line:
+                    print("  " + line)
+
+
+def main():
+    ap = argparse.ArgumentParser(
+        description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="role", required=True)
+    for name in ("peer", "dut"):
+        p = sub.add_parser(name)
+        if name == "peer":
+            p.add_argument("device", help="serial device wired to the Pi")
+        p.add_argument("--modes", default="poll,service",
+                       type=lambda s: s.split(","))
+        p.add_argument("--bauds", default=",".join(map(str, BAUDS)),
+                       type=lambda s: [int(b) for b in s.split(",")])
+        p.add_argument("--count", type=int, default=500)
+        p.add_argument("--interval", type=float, default=0.02,
+                       help="mean seconds between bytes")
+        p.add_argument("--settle", type=float, default=2.0,
+                       help="seconds between rates for the DUT to switch")
+    args = ap.parse_args()
+
+    for baud in args.bauds:
+        if baud not in TERMIOS_BAUD:
+            sys.exit(f"unsupported baud rate {baud}")
+    for mode in args.modes:
+        if mode not in ("poll", "service"):
+            sys.exit(f"unknown RX mode {mode}")
+
+    if args.role == "peer":
+        run_peer(args)
+    else:
+        run_dut(args)
+
+
+if __name__ == "__main__":
+    main()